@@ -0,0 +1,63 @@
+/**
+ * @file arena.cpp
+ * @brief Aligned, optionally huge page backed memory for audio buffers.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+#include "exception.h"
+
+// the huge page size we round mappings up to
+#define HUGEPAGE (2*1024*1024)
+
+bool Arena::hugePages=false;
+BufferId Arena::lastBufferId=0;
+
+Arena::Arena(size_t n){
+    bytes = n*sizeof(float);
+    if(!bytes)bytes=ARENAALIGN;
+    mem = NULL;
+    mapped = false;
+
+#ifdef MAP_HUGETLB
+    if(hugePages){
+        size_t len = (bytes+HUGEPAGE-1)&~(size_t)(HUGEPAGE-1);
+        void *p = mmap(NULL,len,PROT_READ|PROT_WRITE,
+                       MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+        if(p!=MAP_FAILED){
+            // fresh mappings are zero, but touch them now anyway
+            mem = (float *)p;
+            bytes = len;
+            mapped = true;
+        }
+        // otherwise there are no huge pages reserved; fall back
+    }
+#endif
+
+    if(!mem){
+        // transparent huge pages need the block aligned to one
+        size_t align = hugePages ? HUGEPAGE : ARENAALIGN;
+        void *p;
+        if(posix_memalign(&p,align,bytes))
+            throw _("cannot allocate %lu bytes for audio buffers",
+                    (unsigned long)bytes);
+        mem = (float *)p;
+#ifdef MADV_HUGEPAGE
+        // transparent huge pages, if the block is big enough
+        if(hugePages)
+            madvise(p,bytes,MADV_HUGEPAGE);
+#endif
+    }
+    memset(mem,0,bytes);
+}
+
+Arena::~Arena(){
+    if(mapped)
+        munmap(mem,bytes);
+    else
+        free(mem);
+}
@@ -0,0 +1,54 @@
+/**
+ * @file arena.h
+ * @brief A single block of memory holding a MixGraph's audio buffers,
+ * aligned for the SIMD kernels and optionally backed by huge pages.
+ *
+ */
+
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include <stddef.h>
+
+// alignment of the arena and of each buffer in it, in bytes
+#define ARENAALIGN 64
+
+/// the model (chains and effects) refers to its audio buffers by
+/// these, and MixGraph::build() gives each one space in the graph's
+/// arena. 0 is no buffer.
+typedef unsigned int BufferId;
+
+class Arena {
+    float *mem;
+    size_t bytes;
+    // true if mem came from mmap() rather than posix_memalign()
+    bool mapped;
+public:
+    /// try to put arenas in huge pages (set from the command line)
+    static bool hugePages;
+
+    /// allocate an arena of n floats, all zero. The pages are
+    /// touched here so that the process thread won't fault on them.
+    Arena(size_t n);
+    ~Arena();
+
+    float *get(){
+        return mem;
+    }
+
+    /// round a buffer length up so that the next buffer is aligned
+    static size_t round(size_t n){
+        const size_t a = ARENAALIGN/sizeof(float);
+        return (n+a-1)&~(a-1);
+    }
+
+    /// a new buffer ID; they are never reused. Only called by the
+    /// UI thread.
+    static BufferId newBufferId(){
+        return ++lastBufferId;
+    }
+private:
+    static BufferId lastBufferId;
+};
+
+#endif /* __ARENA_H */
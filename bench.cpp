@@ -0,0 +1,554 @@
+/**
+ * @file bench.cpp
+ * @brief Micro-benchmarks for the mixing kernels, for
+ * the whole input/return channel mixing path, for running effect
+ * chains on worker threads, and for Value. Built by
+ * the "bench" target; no jack server is needed.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "channel.h"
+#include "fx.h"
+#include "utils.h"
+#include "kernels.h"
+#include "timeutils.h"
+#include "process.h"
+#include "mixgraph.h"
+#include "workers.h"
+#include "profile.h"
+
+using namespace std;
+
+// roughly how many samples to push through each measurement
+#define SAMPLESPERTEST (1<<22)
+
+static const int blockSizes[] = {16,32,64,128,256,512,BUFSIZE,0};
+static const int chanCounts[] = {1,2,4,8,16,32,64,0};
+
+// summed into at the end of each test so the work can't be optimised away
+static volatile float sink;
+
+// a set of channel buffers, one input and a stereo output per channel,
+// so that the working set grows with the channel count.
+struct BenchBufs {
+    vector<float> data;
+    int n;
+    BenchBufs(int chans,int n_) : data(chans*4*BUFSIZE), n(n_) {
+        for(unsigned int i=0;i<data.size();i++)
+            data[i] = (float)((rand()%2001)-1000)*0.001f;
+    }
+    float *inl(int c){ return &data[(c*4)*BUFSIZE]; }
+    float *inr(int c){ return &data[(c*4+1)*BUFSIZE]; }
+    float *outl(int c){ return &data[(c*4+2)*BUFSIZE]; }
+    float *outr(int c){ return &data[(c*4+3)*BUFSIZE]; }
+};
+
+// the separate panning and mixing passes the mix used before the
+// fused mixer in kernels.h, kept as a baseline for it
+
+// mono panning using a sin/cos taper to avoid the 6db drop at the centre
+static void panmono(float *__restrict left,
+             float *__restrict right,
+             float *__restrict in,
+             float pan,float amp,int n){
+    float ampl = cosf(pan*PI*0.5f);
+    float ampr = sinf(pan*PI*0.5f);
+    for(int i=0;i<n;i++){
+        *left++ = *in * ampl;
+        *right++ = *in++ * ampr;
+    }
+}
+
+// stereo panning (balance) using a linear taper
+static void panstereo(float *__restrict leftout,
+               float *__restrict rightout,
+               float *__restrict leftin,
+               float *__restrict rightin,
+               float pan,float amp,int n){
+    if(pan<0.5f){
+        pan *= 2.0f;
+        for(int i=0;i<n;i++){
+            *leftout++ = *leftin++ * amp;
+            *rightout++ = *rightin++ * pan * amp;
+        }
+    } else {
+        pan = (1.0f-pan)*2.0f;
+        for(int i=0;i<n;i++){
+            *leftout++ = *leftin++ * pan * amp;
+            *rightout++ = *rightin++ * amp;
+        }
+    }
+        
+}
+
+static void addbuffers(float *__restrict dest,
+                       float *__restrict v, int n, float gain){
+    for(int i=0;i<n;i++){
+        *dest++ += gain**v++;
+    }
+}
+
+// run a kernel over every channel, enough times to process about
+// SAMPLESPERTEST samples, and print ns/sample and GB/s given how many
+// bytes the kernel touches per sample.
+template <class F> static void timeKernel(const char *name,int bytesPerSample,F f){
+    printf("%-12s %8s","",name);
+    for(int ci=0;chanCounts[ci];ci++)
+        printf(" %14d",chanCounts[ci]);
+    printf("\n");
+
+    for(int bi=0;blockSizes[bi];bi++){
+        int n = blockSizes[bi];
+        printf("%-12s %8d",name,n);
+        for(int ci=0;chanCounts[ci];ci++){
+            int chans = chanCounts[ci];
+            BenchBufs b(chans,n);
+            int iters = SAMPLESPERTEST/(n*chans);
+            if(iters<1)iters=1;
+
+            // warm up
+            for(int c=0;c<chans;c++)f(b,c);
+
+            Time start;
+            for(int i=0;i<iters;i++){
+                for(int c=0;c<chans;c++)
+                    f(b,c);
+            }
+            double secs = Time()-start;
+            sink = sink + b.outl(0)[0];
+
+            double samples = (double)iters*n*chans;
+            double ns = secs*1e9/samples;
+            double gbs = samples*bytesPerSample/secs*1e-9;
+            printf(" %6.3fns %5.1fG",ns,gbs);
+        }
+        printf("\n");
+    }
+    printf("\n");
+}
+
+static void benchKernels(){
+    printf("Kernels (ns/sample and GB/s, columns are channel counts)\n\n");
+
+    timeKernel("panmono",12,[](BenchBufs& b,int c){
+               panmono(b.outl(c),b.outr(c),b.inl(c),0.3f,0.8f,b.n);
+           });
+    timeKernel("panstereo",16,[](BenchBufs& b,int c){
+               panstereo(b.outl(c),b.outr(c),b.inl(c),b.inr(c),0.3f,0.8f,b.n);
+           });
+    timeKernel("addbuffers",12,[](BenchBufs& b,int c){
+               addbuffers(b.outl(c),b.inl(c),b.n,0.5f);
+           });
+    
+    // the fused mixer, for each kernel set the CPU supports: into the
+    // outputs only, and into the outputs and four sends. Compare the
+    // latter with "unfused", which is how the mix used to do it.
+    static float sendbufs[8][BUFSIZE];
+    timeKernel("unfused",36,[](BenchBufs& b,int c){
+               static float tmpl[BUFSIZE],tmpr[BUFSIZE];
+               panstereo(tmpl,tmpr,b.inl(c),b.inr(c),0.3f,0.8f,b.n);
+               for(int i=0;i<b.n;i++){
+                   b.outl(c)[i]+=tmpl[i];
+                   b.outr(c)[i]+=tmpr[i];
+               }
+               for(int i=0;i<4;i++){
+                   addbuffers(sendbufs[i*2],tmpl,b.n,0.5f);
+                   addbuffers(sendbufs[i*2+1],tmpr,b.n,0.5f);
+               }
+           });
+    const char *best = Kernels::getName();
+    for(int k=0;Kernels::names[k];k++){
+        if(!Kernels::select(Kernels::names[k]))continue;
+        char name[32];
+        snprintf(name,32,"%s1",Kernels::names[k]);
+        timeKernel(name,24,[](BenchBufs& b,int c){
+                   MixDest d = {b.outl(c),b.outr(c),0.3f,0.8f};
+                   BlockLevels pl,pr;
+                   Kernels::mix(b.inl(c),b.inr(c),b.n,&d,1,&pl,&pr);
+               });
+        snprintf(name,32,"%s5",Kernels::names[k]);
+        timeKernel(name,88,[](BenchBufs& b,int c){
+                   MixDest d[5] = {{b.outl(c),b.outr(c),0.3f,0.8f}};
+                   for(int i=0;i<4;i++){
+                       d[i+1].l = sendbufs[i*2];
+                       d[i+1].r = sendbufs[i*2+1];
+                       d[i+1].gl = d[i+1].gr = 0.5f;
+                   }
+                   BlockLevels pl,pr;
+                   Kernels::mix(b.inl(c),b.inr(c),b.n,d,5,&pl,&pr);
+               });
+    }
+    Kernels::select(best);
+    
+    
+    // the meters: the old per-sample peak follower against the block
+    // levels and LevelMeter, both on a stereo channel
+    static float old[64][2];
+    timeKernel("peakold",8,[](BenchBufs& b,int c){
+               for(int s=0;s<2;s++){
+                   float *v = s ? b.inr(c) : b.inl(c);
+                   float cur = old[c][s];
+                   for(int i=0;i<b.n;i++){
+                       float q = fabs(*v++);
+                       if(q>cur)
+                           cur = q;
+                       else
+                           cur = q*0.01f + cur*0.99f;
+                   }
+                   old[c][s] = cur;
+               }
+               b.outl(0)[0]=old[c][0];
+           });
+    static LevelMeter meters[64][2];
+    timeKernel("meter",8,[](BenchBufs& b,int c){
+               BlockLevels lvl,lvr;
+               Kernels::levels(b.inl(c),b.inr(c),b.n,&lvl,&lvr);
+               meters[c][0].in(lvl,1,b.n);
+               meters[c][1].in(lvr,1,b.n);
+               b.outl(0)[0]=meters[c][0].get();
+           });
+}
+
+// build some synthetic channels, half mono and half stereo, with
+// sends to a few empty chains, and time the whole input and return mix
+// of a graph built from them.
+
+static void benchMixPath(int numchans,int numchains,int sendsPerChan,
+                         int live=-1){
+    static int benchnum=0;
+    benchnum++;
+
+    char buf[128];
+    vector<string> chainNames;
+    for(int i=0;i<numchains;i++){
+        snprintf(buf,128,"bench%dchain%d",benchnum,i);
+        chainNames.push_back(buf);
+        ChainInterface::addNewEmptyChain(buf);
+    }
+
+    BenchBufs b(numchans,BUFSIZE);
+    vector<Channel *> chans;
+    for(int i=0;i<numchans;i++){
+        snprintf(buf,128,"bench%dch%d",benchnum,i);
+        Value *g = (new Value("gain"))->setdb()->setdbrange()->setdef(-6)->reset();
+        Value *p = (new Value("pan"))->setrange(0,1)->setdef(0.3f)->reset();
+        Channel *c = new Channel(buf,(i&1)?2:1,g,p,false);
+        c->link();
+        c->setInputBuffers(b.inl(i),b.inr(i));
+        // channels past the live ones are silent
+        if(live>=0 && i>=live){
+            memset(b.inl(i),0,BUFSIZE*sizeof(float));
+            memset(b.inr(i),0,BUFSIZE*sizeof(float));
+        }
+        for(int s=0;s<sendsPerChan && numchains;s++){
+            string cn = chainNames[(i+s)%numchains];
+            Value *sg = (new Value("send"))->setdb()->setdbrange()->setdef(-10)->reset();
+            c->addChainFeed(sg,s&1,ChainInterface::find(cn));
+        }
+        chans.push_back(c);
+    }
+
+    MixGraph *g = MixGraph::build();
+    static float outl[BUFSIZE],outr[BUFSIZE];
+
+    if(live>=0)
+        printf("%3d chans %2d live %d sends:  ",numchans,live,sendsPerChan);
+    else
+        printf("%3d chans %2d chains %d sends:",numchans,numchains,sendsPerChan);
+    for(int bi=0;blockSizes[bi];bi++){
+        int n = blockSizes[bi];
+        int iters = SAMPLESPERTEST/(n*numchans);
+        if(iters<1)iters=1;
+
+        Time start;
+        for(int i=0;i<iters;i++){
+            g->zeroChainInputs(n);
+            g->mixInputs(outl,outr,0,n);
+            g->runChains(outl,outr,0,n);
+        }
+        double secs = Time()-start;
+        sink = sink + outl[0];
+        double ns = secs*1e9/((double)iters*n*numchans);
+        printf(" %6.2f",ns);
+    }
+    printf("\n");
+
+    // tidy up so the next run has only its own channels
+    delete g;
+    Graveyard dead;
+    for(int i=0;i<numchans;i++)
+        delete chans[i];
+    for(int i=numchains-1;i>=0;i--){
+        for(unsigned int j=0;j<chainlist.size();j++){
+            if(chainlist[j]->name == chainNames[i]){
+                ChainInterface::unlinkChain(j,dead);
+                break;
+            }
+        }
+    }
+    dead.free();
+}
+
+static void benchMix(){
+    printf("Mix path: graph mixInputs+runChains, "
+           "ns per channel-sample, columns are block sizes (%s kernels)\n\n",
+           Kernels::getName());
+    printf("%30s","");
+    for(int bi=0;blockSizes[bi];bi++)
+        printf(" %6d",blockSizes[bi]);
+    printf("\n");
+    for(int ci=0;chanCounts[ci];ci++){
+        benchMixPath(chanCounts[ci],0,0);
+        benchMixPath(chanCounts[ci],4,1);
+        benchMixPath(chanCounts[ci],4,4);
+    }
+    // a typical show: most of the inputs silent at any time
+    benchMixPath(64,4,4,12);
+    benchMixPath(64,4,4,0);
+    printf("\n");
+}
+
+// a stand-in for an expensive effect: a bank of one-pole filters
+// over its own buffer, about as much work per sample as a reverb.
+struct BenchFx {
+    float buf[BUFSIZE];
+    float state[64];
+};
+
+static void benchFxRun(LADSPA_Handle h,unsigned long n){
+    BenchFx *f = (BenchFx *)h;
+    for(int k=0;k<64;k++){
+        float s = f->state[k];
+        float c = 0.5f+k*0.007f;
+        for(unsigned long i=0;i<n;i++){
+            s = s*c + f->buf[i]*(1.0f-c);
+            f->buf[i] = s;
+        }
+        f->state[k] = s;
+    }
+}
+
+// run a number of independent chains of these on 1 to N threads
+// and report how it scales.
+
+static void benchFxChains(int numchains,int fxPerChain,int n){
+    vector<BenchFx> fx(numchains*fxPerChain);
+    vector<ProfStats *> profs;
+    MixGraph *g = new MixGraph();
+    MixGraph::Level l = {0,numchains,0,0,0,0};
+    g->levels.push_back(l);
+    for(int i=0;i<numchains;i++){
+        profs.push_back(new ProfStats());
+        MixGraph::Branch b = {(int)g->fx.size(),fxPerChain,profs.back(),false};
+        g->branches.push_back(b);
+        for(int j=0;j<fxPerChain;j++){
+            BenchFx *f = &fx[i*fxPerChain+j];
+            for(int k=0;k<BUFSIZE;k++)
+                f->buf[k] = (float)((rand()%2001)-1000)*0.001f;
+            memset(f->state,0,sizeof(f->state));
+            profs.push_back(new ProfStats());
+            MixGraph::Fx e = {f,benchFxRun,profs.back()};
+            g->fx.push_back(e);
+        }
+    }
+
+    static float outl[BUFSIZE],outr[BUFSIZE];
+    int iters = SAMPLESPERTEST/(n*8);
+    if(iters<1)iters=1;
+    printf("%2d chains, %d fx each, block %4d:",numchains,fxPerChain,n);
+    double base=0;
+    int maxthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    for(int t=1;t<=maxthreads && t<=MAXWORKERS;t*=2){
+        Workers::init(t);
+        Time start;
+        for(int i=0;i<iters;i++)
+            g->runChains(outl,outr,0,n);
+        double us = (Time()-start)*1e6/iters;
+        Workers::shutdown();
+        if(t==1)base=us;
+        printf("  %dT %7.1fus x%.2f",t,us,base/us);
+    }
+    printf("\n");
+    sink = sink + fx[0].buf[0];
+    delete g;
+    for(unsigned int i=0;i<profs.size();i++)
+        delete profs[i];
+}
+
+static void benchFx(){
+    printf("FX chains on worker threads (us per block, and speedup)\n\n");
+    benchFxChains(1,4,256);
+    benchFxChains(2,2,256);
+    benchFxChains(4,2,256);
+    benchFxChains(8,2,256);
+    benchFxChains(8,2,64);
+    benchFxChains(16,1,256);
+    
+    // what timing each effect adds
+    ProfStats p;
+    int iters = SAMPLESPERTEST/16;
+    uint64_t t = Profile::now();
+    Time start;
+    for(int i=0;i<iters;i++){
+        uint64_t t1 = Profile::now();
+        p.record(t1-t);
+        t = t1;
+    }
+    double secs = Time()-start;
+    printf("\nprofiling overhead %.1fns per effect run\n\n",secs*1e9/iters);
+}
+
+// reading dB values, which used to do a powf on every get() and now
+// read a cached conversion, and the per-period update of all values
+// while they are settling and once they have settled.
+
+static void benchValues(){
+    printf("Values (ns per value)\n\n");
+    
+    const int numvals = 256;
+    vector<Value *> vals;
+    for(int i=0;i<numvals;i++){
+        Value *v = (new Value("bench"))->setdb()->setdbrange()->
+              setdef(-(float)(i%60))->reset();
+        vals.push_back(v);
+    }
+    int iters = SAMPLESPERTEST/numvals;
+    float acc=0;
+    
+    Time start;
+    for(int i=0;i<iters;i++){
+        for(int j=0;j<numvals;j++)
+            acc += powf(10.0,vals[j]->getNoDBConvert()*0.1f);
+    }
+    double secs = Time()-start;
+    printf("%-24s %8.3fns\n","get (powf)",secs*1e9/((double)iters*numvals));
+    
+    start = Time();
+    for(int i=0;i<iters;i++){
+        for(int j=0;j<numvals;j++)
+            acc += vals[j]->get();
+    }
+    secs = Time()-start;
+    printf("%-24s %8.3fns\n","get (cached)",secs*1e9/((double)iters*numvals));
+    
+    // updating while moving: keep resetting to a new target
+    start = Time();
+    for(int i=0;i<iters/64;i++){
+        for(int j=0;j<numvals;j++)
+            vals[j]->setTarget((i&1)?-60:0);
+        for(int k=0;k<64 && i*64+k<iters;k++){
+            for(int j=0;j<numvals;j++)
+                vals[j]->update(BUFSIZE,48000);
+        }
+    }
+    secs = Time()-start;
+    printf("%-24s %8.3fns\n","update (moving)",secs*1e9/((double)(iters/64)*64*numvals));
+    
+    for(int j=0;j<numvals;j++)
+        vals[j]->reset();
+    start = Time();
+    for(int i=0;i<iters;i++){
+        for(int j=0;j<numvals;j++)
+            vals[j]->update(BUFSIZE,48000);
+    }
+    secs = Time()-start;
+    printf("%-24s %8.3fns\n\n","update (settled)",secs*1e9/((double)iters*numvals));
+    
+    sink = sink + acc;
+    for(int j=0;j<numvals;j++)
+        delete vals[j];
+}
+
+// the per-ramp update of a large set of values (effect parameters)
+// of which only a few are moving: every value, as it used to be done,
+// against just the active set.
+
+static void benchActiveValues(){
+    printf("Value updates per ramp, 4096 values (ns per ramp)\n\n");
+    printf("%-10s %12s %12s\n","moving","all","active set");
+    
+    const int numvals = 4096;
+    static const int moving[] = {0,16,256,4096,-1};
+    vector<Value *> vals;
+    for(int i=0;i<numvals;i++){
+        Value *v = (new Value("bench"))->setrange(0,1)->setsmoothms(1000)->
+              setdef((float)(i%100)*0.01f)->reset();
+        vals.push_back(v);
+    }
+    vector<Value *> set(numvals);
+    const int iters = 20000;
+    
+    for(int m=0;moving[m]>=0;m++){
+        int nm = moving[m];
+        double secs[2];
+        for(int k=0;k<2;k++){
+            // start each from the same place
+            for(int j=0;j<numvals;j++)
+                vals[j]->reset();
+            Value::startActive(vals,&set[0],numvals);
+            Time start;
+            for(int i=0;i<iters;i++){
+                // keep the moving ones moving: a new target every 64
+                // ramps, which they won't reach in that time
+                if(!(i&63)){
+                    for(int j=0;j<nm;j++)
+                        vals[j*(numvals/nm)]->setTarget((i&64) ? 0 : 1);
+                }
+                if(k)
+                    Value::updateActive(BUFSIZE,48000);
+                else {
+                    for(int j=0;j<numvals;j++)
+                        vals[j]->update(BUFSIZE,48000);
+                }
+            }
+            secs[k] = Time()-start;
+        }
+        printf("%-10d %10.0fns %10.0fns\n",nm,
+               secs[0]*1e9/iters,secs[1]*1e9/iters);
+    }
+    printf("\n");
+    for(int j=0;j<numvals;j++)
+        delete vals[j];
+    vals.clear();
+    Value::startActive(vals,NULL,0);
+}
+
+int main(int argc,char *argv[]){
+    // no jack here - channels don't register ports
+    Process::offline = true;
+    Process::samprate = 48000;
+    Process::init();
+
+    try {
+        bool kernels=true,mix=true,fx=true,values=true;
+        if(argc>1){
+            kernels = !strcmp(argv[1],"kernels");
+            mix = !strcmp(argv[1],"mix");
+            fx = !strcmp(argv[1],"fx");
+            values = !strcmp(argv[1],"values");
+            if(!kernels && !mix && !fx && !values){
+                fprintf(stderr,"usage: bench [kernels|mix|fx|values]\n");
+                return 1;
+            }
+        }
+        if(kernels)benchKernels();
+        if(mix)benchMix();
+        if(fx)benchFx();
+        if(values){
+            benchValues();
+            benchActiveValues();
+        }
+    } catch(string s){
+        fprintf(stderr,"Fatal error: %s\n",s.c_str());
+        return 1;
+    }
+    return 0;
+}
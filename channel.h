@@ -10,11 +10,13 @@
 #include <jack/jack.h>
 #include <vector>
 #include <string>
+#include <unordered_map>
 #include <algorithm>
 #include <fstream>
 #include "value.h"
 #include "global.h"
 #include "fx.h"
+#include "meters.h"
 
 // info describing how a chain is fed
 struct ChainFeed {
@@ -34,19 +36,31 @@ struct ChainFeed {
 
 
 class Channel {
+    // the compiled graph reads the buffers, meters and mute state
+    friend struct MixGraph;
+    
     // if ports are null, this is the name of an FX chain. 
     // The left and right buffers will be set to that chain.
     std::string returnChainName;
+    // and the chain itself, once resolved
+    ChainInterface *returnChain;
     bool mono;
+    // true if this is a return channel (ports will be null)
+    bool isret;
+    // true if this is in one of the channel lists
+    bool linked;
     
+    // the channel lists. These are the model, only changed outside
+    // the process thread, which mixes from a MixGraph built from them.
     static std::vector<Channel *> inputchans,returnchans;
+    // and the linked channels by ID
+    static std::unordered_map<unsigned int,Channel *> ids;
+    static unsigned int nextId;
     
     
     
     // create an input port
     static jack_port_t *makePort(std::string pname);
-    // mix this channel into the output
-    void mix(float *leftout,float *rightout,int offset,int nframes);
     // store the jack buffer pointers, but do not store them between
     // process() calls. Does not do anything with return channels.
     void cachebufs(int nframes){
@@ -57,22 +71,24 @@ class Channel {
     }
     
     // if mono, only leftport is used - both will be null if this
-    // is a return.
+    // is a return, or if we are rendering offline.
     jack_port_t *leftport,*rightport;
     
-    // these cache the port buffers, but only inside one call to process()
+    // these cache the port buffers, but only inside one call to
+    // process(). Not used for returns, whose buffers are in the graph.
     float *left,*right;
     
     
-    PeakMonitor monl,monr;
+    LevelMeter monl,monr;
     bool mute=false;
     static Channel *solochan;
     
     void resolveChains(){
-        // resolve sends
+        // resolve sends; after this the names aren't needed.
         for(unsigned int i=0;i<chainNames.size();i++){
             chains[i].chain = ChainInterface::find(chainNames[i]);
         }
+        chainNames.clear();
         
         // and returns
         resolveReturnChannel();
@@ -81,28 +97,43 @@ class Channel {
 
 public:
     std::string name;
+    // a number for the channel which is never reused, so that meter
+    // readings can refer to it
+    unsigned int id;
+    // the channel's loudness meter, if it has one
+    class LoudnessTap *tap;
     Value *pan,*gain;
-    // names of chains, same indexing as "chains"
+    // names of chains from the parser, same indexing as "chains",
+    // only used until the chains are resolved.
     std::vector<std::string> chainNames;
     // pointers to actual chains, built from chainNames after parsing.
     std::vector<ChainFeed> chains;
     
-    // if a return channel, resolve the buffers to be the output of the last
-    // chain we are a return for. Called both from resolveChains() and from
-    // the chain create code in the UI.
+    // if a return channel, find the chain we are a return for. Called
+    // both from resolveChains() and from the chain create code in the UI.
+    // The graph reads the chain's output buffers when it is built.
     
     void resolveReturnChannel(){
-        if(!leftport) { // we are a return, and returnChainName should be valid
-            ChainInterface *ch = ChainInterface::find(returnChainName);
-            left = ch->leftoutbuf;
-            right = ch->rightoutbuf;
-        }
+        if(isret && !returnChain) // returnChainName should be valid
+            returnChain = ChainInterface::find(returnChainName);
     }
     
     
     // is this a return channel?
     bool isReturn(){
-        return leftport==NULL;
+        return isret;
+    }
+    
+    bool isMono(){
+        return mono;
+    }
+    
+    // set the input buffers directly, instead of getting them from
+    // the jack ports. Used by the offline renderer; like cachebufs(),
+    // the pointers are only used until the next process() call.
+    void setInputBuffers(float *l,float *r){
+        left = l;
+        right = r;
     }
     
     // return the name of the chain we are a return from (valid only
@@ -149,14 +180,20 @@ public:
     }
     
     
-    Channel(std::string n,int ch,Value *g,Value *p,bool isret,
-            std::string rcn="") : monl(n+"l"), monr(n+"r")
+    Channel(std::string n,int ch,Value *g,Value *p,bool isr,
+            std::string rcn="")
     {
         name = n;
+        id = nextId++;
         mono = ch==1;
         gain = g;
         pan = p;
         returnChainName=rcn;
+        returnChain=NULL;
+        isret = isr;
+        linked = false;
+        tap = NULL;
+        left = right = NULL;
         
         // if this is a return, we don't create ports - instead,
         // we'll use output buffers in the chains.
@@ -171,52 +208,63 @@ public:
                 rightport = makePort(n+"_R");
             }
         }
-        if(isret)
-            returnchans.push_back(this);
-        else
-            inputchans.push_back(this);
     }
     
+    // deletes the channel's values too. Must not be in a graph
+    // the process thread might be running.
     virtual ~Channel();
     
+    // add to the appropriate channel list, so the channel is in the
+    // next graph built, and link its values.
+    void link();
+    // remove from the channel list and unlink the values; the channel
+    // goes into the graveyard until no graph uses it.
+    void unlink();
     
-    // add a chain send - if from the parser, leave chain NULL to be resolved.
-    void addChainInfo(std::string name,Value *v,bool postfade,ChainInterface *c=NULL){
-        chains.push_back(ChainFeed(v,postfade,c));
+    // add a chain send from the parser, with the chain to be resolved.
+    void addChainInfo(std::string name,Value *v,bool postfade){
+        chains.push_back(ChainFeed(v,postfade,NULL));
         chainNames.push_back(name);
     }
     
-    // remove a chain send or nothing if there is no such send.
-    // DO NOT CALL FROM MAIN THREAD.
-    void removeChainInfo(unsigned int i){
-        if(i<chainNames.size()){
-            chainNames.erase(chainNames.begin()+i);
+    // add a send to an existing chain
+    void addChainFeed(Value *v,bool postfade,ChainInterface *c){
+        chains.push_back(ChainFeed(v,postfade,c));
+        v->link();
+    }
+    
+    // remove a chain send, returning its gain value (unlinked, to
+    // be deleted by the caller) or NULL if there is no such send.
+    Value *removeChainInfo(unsigned int i){
+        if(i<chains.size()){
+            Value *v = chains[i].gain;
+            v->unlink();
             chains.erase(chains.begin()+i);
+            return v;
         }
+        return NULL;
     }
     
-    // remove chain info for a named chain, called if the chain is destroyed
-    void removeChainInfo(std::string n){
-        std::vector<std::string>::iterator nit = chainNames.begin();
+    // remove chain info for a chain, called if the chain is destroyed.
+    // The send values are unlinked and added to dead, to be deleted
+    // by the caller.
+    void removeChainInfo(ChainInterface *ch,std::vector<Value *>& dead){
         std::vector<ChainFeed>::iterator cit = chains.begin();
-        
-        while(nit!=chainNames.end()){
-            if(*nit == n)
-                nit = chainNames.erase(nit);
-            else
-                nit++;
-        }
         while(cit!=chains.end()){
-            if((*cit).chain->name == n)
+            if((*cit).chain == ch){
+                (*cit).gain->unlink();
+                dead.push_back((*cit).gain);
                 cit = chains.erase(cit);
-            else
+            } else
                 cit++;
         }
     }
     
-    // a chain is being removed, so remove its return channel
-    // and any sends to it.
-    static void removeReturnChannelsAndSends(std::string chainname);
+    // a chain is being removed, so remove (unlink) its return channel
+    // and any sends to it. Returns the return channel, if any, and
+    // adds the send values to dead.
+    static Channel *removeReturnChannelsAndSends(ChainInterface *ch,
+                                                 std::vector<Value *>& dead);
     
     static void resolveAllChannelChains(){
         std::vector<Channel *>::iterator it;
@@ -229,22 +277,19 @@ public:
         }
     }
     
-    static void writeMons(struct MonitorData* m);
-    
-    
-    // mixes all input channels into the output buffer and into the send
-    // buffer, clearing those buffers first. Called *before* effects processing.
-    static void mixInputChannels(float *leftout,float *rightout,int offset,int nframes);
-    // does the same for the return channels. Called *after* effects processing.
-    static void mixReturnChannels(float *leftout,float *rightout,int offset,int nframes);
+    // find a linked channel from its ID, or NULL
+    static Channel *getChannelById(unsigned int id){
+        std::unordered_map<unsigned int,Channel *>::iterator it = ids.find(id);
+        return it==ids.end() ? NULL : it->second;
+    }
     
-    // call once per process() to cache port buffer pointers. Note
-    // this isn't called (or required) for return channels.
-    static void cacheAllChannelBuffers(int nframes){
-        std::vector<Channel *>::iterator it;
-        for(it=inputchans.begin();it!=inputchans.end();it++){
-            (*it)->cachebufs(nframes);
-        }
+    // access to the input channels, so that the offline renderer can
+    // feed them
+    static int getNumInputChannels(){
+        return (int)inputchans.size();
+    }
+    static Channel *getInputChannel(int i){
+        return inputchans[i];
     }
     
     // save a single channel 
@@ -13,6 +13,7 @@
 
 using namespace std;
 unordered_map<string,Ctrl *> Ctrl::map;
+std::atomic<Ctrl *> Ctrl::dirtyList(NULL);
 
 Ctrl *Ctrl::createOrFind(string name,bool nocreate){
     Ctrl *v;
@@ -30,11 +31,35 @@ Ctrl *Ctrl::createOrFind(string name,bool nocreate){
 }
 
 Ctrl::~Ctrl() {
-    if(source)source->remove(this);
-    map.erase(nameString);
-    delete ring;
+    unlink();
+    for(unsigned int i=0;i<values.size();i++)
+        values[i]->ctrl = NULL;
 }
 
+void Ctrl::unlink(){
+    if(source){
+        source->remove(this);
+        source = NULL;
+    }
+    // a new ctrl may have the name by now
+    unordered_map<string,Ctrl *>::iterator it = map.find(nameString);
+    if(it!=map.end() && it->second==this)
+        map.erase(it);
+}
+
+void Ctrl::pollDirty(){
+    Ctrl *c = dirtyList.exchange(NULL,std::memory_order_acquire);
+    while(c){
+        Ctrl *next = c->nextDirty;
+        // clear the flag before reading the setting, so that a newer
+        // one puts the ctrl back on the list
+        c->dirty.exchange(false,std::memory_order_acq_rel);
+        float f = c->latest.load(std::memory_order_relaxed);
+        for(unsigned int i=0;i<c->values.size();i++)
+            c->values[i]->setTargetConvert(f);
+        c = next;
+    }
+}
 
 vector<Ctrl *> Ctrl::getList(){
     vector<Ctrl *> lst;
@@ -69,23 +94,6 @@ void Ctrl::checkAllCtrlsForSource(){
     }
 }
 
-void Ctrl::removeAllAssociations(Value *v){
-    unordered_map<string,Ctrl *>::iterator it;
-    for(it=map.begin();it!=map.end();it++){
-        Ctrl *c = it->second;
-        c->remval(v);
-    }
-}
-
-void Ctrl::pollAllCtrlRings(){
-    unordered_map<string,Ctrl *>::iterator it;
-    for(it=map.begin();it!=map.end();it++){
-        Ctrl *c = it->second;
-        c->pollRing();
-    }
-}
-
-
 Ctrl *Ctrl::setsource(CtrlSource *s,string spec){
     sourceString = spec;
     const char *err = s->add(spec,this);
@@ -12,8 +12,8 @@
 #include <vector>
 #include <ostream>
 #include <algorithm>
+#include <atomic>
 #include "value.h"
-#include "ringbuffer.h"
 #include "ctrlsource.h"
 
 /// this is a control channel, used to manage a list of values.
@@ -28,30 +28,22 @@ class Ctrl {
     /// in into the 0-1 range. 
     float inmin,inmax;
     
-    /// and there is a map of all the control channels
+    /// and there is a map of all the control channels. It is only
+    /// changed outside the process thread.
     static std::unordered_map<std::string,Ctrl *> map;
     
-    /// this is a ring buffer - it is used to pass ctrl change data
-    /// from the reader thread for particular source types into
-    /// the process thread, where values can be changed.
-    RingBuffer<float> *ring;
-
-    /// this code is called inside the Jack process thread:
-    /// it checks the ring buffer for any new setting, and passes
-    /// it onto the values.
-    
-    void pollRing(){
-        float f;
-        bool got=false;
-        while(ring->read(f)){got=true;}
-        if(got){
-            std::vector<Value *>::iterator it;
-            for(it=values.begin();it!=values.end();it++){
-                (*it)->setTargetConvert(f);
-            }
-        }
-    }
-
+    /// the latest setting from the source, converted to 0-1. Only the
+    /// latest matters, so a newer one just replaces it.
+    std::atomic<float> latest;
+    
+    /// ctrls with a new setting are put on the dirty list (once, so
+    /// this is set while it is on there) for the process thread to
+    /// pass on to their values. It is a lock-free stack any thread
+    /// can push onto, and the process thread takes the lot.
+    std::atomic<bool> dirty;
+    Ctrl *nextDirty;
+    static std::atomic<Ctrl *> dirtyList;
+    
 public:
     static Ctrl *createOrFind(std::string name, bool nocreate=false);
     /// name string copy, for information only. Set in setsource()
@@ -78,10 +70,16 @@ public:
         source = NULL;
         sourceInfo = NULL;
         inmin=0;inmax=1;
-        ring = new RingBuffer<float>(20);
+        latest.store(0);
+        dirty.store(false);
+        nextDirty = NULL;
     }
     
     virtual ~Ctrl();
+    
+    /// remove from the map and from the source, ready to be deleted
+    /// when the process thread has finished with it
+    void unlink();
         
     Ctrl *setinrange(float mn,float mx){
         inmin=mn;inmax=mx;
@@ -114,26 +112,37 @@ public:
     }
     
     /// set a value; will convert the input then pass it down to the
-    /// individual values, VIA THE RING BUFFER. It should be called
-    /// from the source handler thread, and from one thread only
-    /// for each control. It will just fill the ring and then
-    /// do nothing if ringPoll() isn't regularly called.
+    /// individual values when the process thread next calls
+    /// pollDirty(). Any thread can call it, and a value set before
+    /// that is replaced.
     void setval(float v){
         v = (v-inmin)/(inmax-inmin);
-        ring->write(v);
+        latest.store(v,std::memory_order_relaxed);
+        if(!dirty.exchange(true,std::memory_order_acq_rel)){
+            Ctrl *head = dirtyList.load(std::memory_order_relaxed);
+            do {
+                nextDirty = head;
+            } while(!dirtyList.compare_exchange_weak(head,this,
+                                                     std::memory_order_release,
+                                                     std::memory_order_relaxed));
+        }
     }
     
+    /// called in the process thread: pass the latest setting of each
+    /// ctrl on the dirty list to its values.
+    static void pollDirty();
+    
     /// Check all values
     /// all have an external control channel.
     static void checkAllCtrlsForSource();
     
-    /// call from the jack process thread regularly; will poll
-    /// all the ctrl ring buffers, reading data. If there is
-    /// any, it will be passed down to the values.
-    static void pollAllCtrlRings();
-    
-    /// remove this value from all controls (it has been deleted or reassociated)
-    static void removeAllAssociations(Value *v);
+    /// remove this value from all controls (it has been deleted or
+    /// reassociated). A value is only ever in the list of the
+    /// control it points to.
+    static void removeAllAssociations(Value *v){
+        if(v->ctrl)
+            v->ctrl->remval(v);
+    }
     
     
     static void saveAll(std::ostream &out);
@@ -0,0 +1,35 @@
+/**
+ * @file denormals.cpp
+ * @brief Flush-to-zero mode and the subnormal check.
+ *
+ */
+
+#include "denormals.h"
+#include "profile.h"
+#include "fx.h"
+
+std::atomic<bool> Denormals::flush(true);
+std::atomic<bool> Denormals::check(false);
+
+void Denormals::dump(FILE *f){
+    if(!check.load()){
+        fprintf(f,"Subnormal check off\n");
+        return;
+    }
+    fprintf(f,"Subnormal outputs by effect:\n");
+    int n=0;
+    for(unsigned int i=0;i<chainlist.size();i++){
+        const std::vector<PluginInstance *>& fx = chainlist[i]->getEffects();
+        for(unsigned int j=0;j<fx.size();j++){
+            ProfSummary s;
+            fx[j]->prof->get(s);
+            if(!s.denormals)continue;
+            fprintf(f,"  %s/%s (%s): %llu\n",
+                    chainlist[i]->name.c_str(),fx[j]->name.c_str(),
+                    fx[j]->p->label.c_str(),(unsigned long long)s.denormals);
+            n++;
+        }
+    }
+    if(!n)
+        fprintf(f,"  none\n");
+}
@@ -0,0 +1,62 @@
+/**
+ * @file denormals.h
+ * @brief Flush-to-zero and denormals-are-zero on the threads which run
+ * the mix, and a diagnostic check for effects which make subnormal
+ * numbers. Subnormals turn up in the decaying tails of recursive
+ * filters and reverbs, and on most CPUs each one costs many times as
+ * much as a normal number.
+ *
+ */
+
+#ifndef __DENORMALS_H
+#define __DENORMALS_H
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+
+#if defined(__SSE__) || defined(__x86_64__)
+#include <xmmintrin.h>
+// the FTZ and DAZ bits of the MXCSR register
+#define DENORMAL_BITS 0x8040
+#endif
+
+struct Denormals {
+    /// whether the mix's threads flush subnormals to zero; on by
+    /// default, set by 'denormals flush' or 'denormals keep' in the
+    /// config.
+    static std::atomic<bool> flush;
+
+    /// whether each effect's outputs are checked for subnormals after
+    /// it runs, and how many there were recorded in its ProfStats.
+    /// Only useful with flush off, as otherwise there won't be any.
+    static std::atomic<bool> check;
+
+    /// called by each thread which runs effects, before it runs them:
+    /// set its floating point mode to match flush, if it doesn't
+    /// already. Cheap when nothing changes.
+    static void apply(){
+        bool f = flush.load(std::memory_order_relaxed);
+#ifdef DENORMAL_BITS
+        unsigned int csr = _mm_getcsr();
+        unsigned int want = f ? DENORMAL_BITS : 0;
+        if((csr&DENORMAL_BITS)!=want)
+            _mm_setcsr((csr&~DENORMAL_BITS)|want);
+#elif defined(__aarch64__)
+        // the FZ bit of the FPCR, which does both
+        uint64_t fpcr;
+        __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+        uint64_t want = f ? (1ULL<<24) : 0;
+        if((fpcr&(1ULL<<24))!=want)
+            __asm__ __volatile__("msr fpcr, %0" : : "r"((fpcr&~(1ULL<<24))|want));
+#else
+        (void)f;
+#endif
+    }
+
+    /// print the effects which have made subnormals since the profile
+    /// was last reset
+    static void dump(FILE *f);
+};
+
+#endif /* __DENORMALS_H */
@@ -102,7 +102,7 @@ void DiamondSource::poll(){
                     val = 0; // or use zero if not in topic
                 
                 // now iterate over the controls for this index of
-                // this topic, and send it to the ringbuffer of that control
+                // this topic, and send it to that control
                 vector<Ctrl*>::iterator it3;
                 for(it3 = it2->second.begin();
                     it3!=it2->second.end();it3++){
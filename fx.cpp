@@ -8,6 +8,7 @@
 #include <unordered_map>
 #include <vector>
 #include <iostream>
+#include <math.h>
 
 #include "tokeniser.h"
 #include "tokens.h"
@@ -19,12 +20,29 @@
 #include "channel.h"
 #include "save.h"
 #include "ctrl.h"
+#include "arena.h"
+#include "profile.h"
+#include "process.h"
 
 using namespace std;
 
 vector<ChainInterface *> chainlist;
 Value *parseValue(Bounds b,Value *v=NULL);
-float *zeroBuf;
+BufferId zeroBuf;
+
+ChainInterface::ChainInterface(){
+    inpleft = Arena::newBufferId();
+    inpright = Arena::newBufferId();
+    prof = new ProfStats();
+    suspendDb = SUSPENDDB;
+    suspendHold = SUSPENDHOLD;
+    suspended = false;
+    quietFrames = 0;
+}
+
+ChainInterface::~ChainInterface(){
+    delete prof;
+}
 
 struct Chain : public ChainInterface {
     Chain() : ChainInterface() {
@@ -48,8 +66,16 @@ struct Chain : public ChainInterface {
     
     // vector so we can run in order
     vector<PluginInstance *> fxlist;
-    // map so we can find
-    unordered_map<string,PluginInstance *> fxmap;
+    
+    // find an effect by name, or NULL. A linear search, but the lists
+    // are short.
+    PluginInstance *findEffect(const string& n){
+        for(unsigned int i=0;i<fxlist.size();i++){
+            if(fxlist[i]->name == n)
+                return fxlist[i];
+        }
+        return NULL;
+    }
     
     // names of things, kept for saving
     string rightoutport,leftoutport,rightouteffect,leftouteffect;
@@ -58,7 +84,9 @@ struct Chain : public ChainInterface {
     // by same order as fxlist, then within that, by input.
     vector<vector<InputConnectionData>*> inputConnData;
     
-    // resolve connections within the chain
+    // resolve connections within the chain. These are only recorded
+    // in the instances here; the ports are connected by the process
+    // thread when it picks up a graph with them in.
     void resolveInputs(bool debugout=true){
         if(fxlist.size()!=inputConnData.size())
             throw _("size mismatch in effect lists");
@@ -70,7 +98,7 @@ struct Chain : public ChainInterface {
             
             for(unsigned int j=0;j<ipdl->size();j++){
                 InputConnectionData& ipd = (*ipdl)[j];
-                float *buf;
+                BufferId buf;
                 switch(ipd.channel){
                 case 0:
                     if(debugout)cout << "Left input";
@@ -93,13 +121,12 @@ struct Chain : public ChainInterface {
                     throw _("weird case in ipd channel: %d\n",ipd.channel);
                 }
                 
-                // make the connection for the input port
+                // record the connection for the input port
                 if(debugout){
-                    cout << " has address " << buf;
+                    cout << " has buffer " << buf;
                     cout << ", connecting to " << ipd.port << endl;
                 }
-                (*p->p->desc->connect_port)(p->h,ipd.port,buf);
-                p->connections[ipd.port]=buf;
+                p->inbufs[ipd.port]=buf;
             }
         }
     }
@@ -107,19 +134,19 @@ struct Chain : public ChainInterface {
     // resolve a possibly short port name to a proper one
     string getRealPortName(string effect,string port){
         if(effect=="zero")return "zero";
-        if(fxmap.find(effect)==fxmap.end())
+        PluginInstance *inst = findEffect(effect);
+        if(!inst)
             throw _("cannot find effect '%s'",effect.c_str());
-        PluginInstance *inst = fxmap[effect];
         int fpidx = inst->p->getPortIdx(port);
         return string(inst->p->desc->PortNames[fpidx]);
     }
     
     
-    float *getPort(string effect,string port){
+    BufferId getPort(string effect,string port){
         if(effect=="zero")return zeroBuf;
-        if(fxmap.find(effect)==fxmap.end())
+        PluginInstance *inst = findEffect(effect);
+        if(!inst)
             throw _("cannot find source effect '%s'",effect.c_str());
-        PluginInstance *inst = fxmap[effect];
         int fpidx = inst->p->getPortIdx(port);
         
         if(inst->opbufs.find(fpidx)==inst->opbufs.end())
@@ -129,16 +156,115 @@ struct Chain : public ChainInterface {
         return inst->opbufs[fpidx];
     }
     
-    virtual void run(unsigned int nframes){
-        vector<PluginInstance *>::iterator it;
-        for(it = fxlist.begin();it!=fxlist.end();it++){
-            PluginInstance *p = *it;
-//            printf("Running %s\n",p->name.c_str());
-//            p->dump();
-            (*p->p->desc->run)(p->h,nframes);
+    virtual void addBuffers(MixGraph *g,int level){
+        // the inputs are filled before any chains run
+        g->addBuffer(inpleft,-1);
+        g->addBuffer(inpright,-1);
+        
+        // effect outputs are only needed while the level runs, unless
+        // an effect which runs before takes them, in which case it
+        // gets the last block's.
+        vector<bool> keep(fxlist.size(),false);
+        for(unsigned int i=0;i<fxlist.size();i++){
+            vector<InputConnectionData> *ipdl = inputConnData[i];
+            for(unsigned int j=0;j<ipdl->size();j++){
+                InputConnectionData& ipd = (*ipdl)[j];
+                if(ipd.channel!=-1)continue;
+                for(unsigned int k=i;k<fxlist.size();k++)
+                    if(fxlist[k]->name == ipd.fromeffect)
+                        keep[k]=true;
+            }
+        }
+        for(unsigned int i=0;i<fxlist.size();i++){
+            unordered_map<int,BufferId>::iterator it;
+            PluginInstance *p = fxlist[i];
+            for(it=p->opbufs.begin();it!=p->opbufs.end();it++){
+                if(it->second)
+                    g->addBuffer(it->second,keep[i] ? -1 : level);
+            }
         }
     }
     
+    // find the branch an effect is in, for compile()
+    static int findBranch(vector<int>& b,int i){
+        while(b[i]!=i)
+            i = b[i] = b[b[i]];
+        return i;
+    }
+    
+    virtual void compile(MixGraph *g){
+        g->chainInputs.push_back(g->buf(inpleft));
+        g->chainInputs.push_back(g->buf(inpright));
+        
+        MixGraph::ChainRun run;
+        run.chain = this;
+        run.inl = g->buf(inpleft);
+        run.inr = g->buf(inpright);
+        run.outl = g->buf(leftoutbuf);
+        run.outr = g->buf(rightoutbuf);
+        run.level = powf(10.0f,suspendDb/20.0f);
+        run.holdFrames = suspendHold<0 || fxlist.empty() ? 0 :
+              (unsigned int)(suspendHold*Process::samprate/1000.0f)+1;
+        run.firstBranch = g->branches.size();
+        
+        // effects connected to each other, however indirectly, go in
+        // the same branch and are run in order; separate branches can
+        // run in parallel.
+        vector<int> branch(fxlist.size());
+        for(unsigned int i=0;i<fxlist.size();i++)
+            branch[i]=i;
+        for(unsigned int i=0;i<fxlist.size();i++){
+            vector<InputConnectionData> *ipdl = inputConnData[i];
+            for(unsigned int j=0;j<ipdl->size();j++){
+                InputConnectionData& ipd = (*ipdl)[j];
+                if(ipd.channel!=-1)continue;
+                for(unsigned int k=0;k<fxlist.size();k++){
+                    if(fxlist[k]->name == ipd.fromeffect){
+                        branch[findBranch(branch,i)]=findBranch(branch,k);
+                        break;
+                    }
+                }
+            }
+        }
+        
+        for(unsigned int b=0;b<fxlist.size();b++){
+            if(findBranch(branch,b)!=(int)b)continue;
+            MixGraph::Branch r = {(int)g->fx.size(),0,prof,false};
+            for(unsigned int i=0;i<fxlist.size();i++){
+                if(findBranch(branch,i)!=(int)b)continue;
+                PluginInstance *p = fxlist[i];
+                MixGraph::Fx f = {p->h,p->p->desc->run,p->prof,
+                    (int)g->fxOutputs.size(),0};
+                vector<InputConnectionData> *ipdl = inputConnData[i];
+                for(unsigned int j=0;j<ipdl->size();j++){
+                    int port = (*ipdl)[j].port;
+                    MixGraph::Conn c = {p->h,p->p->desc->connect_port,
+                        (unsigned long)port,g->buf(p->inbufs[port])};
+                    g->conns.push_back(c);
+                }
+                // and the outputs
+                unordered_map<int,BufferId>::iterator it;
+                for(it=p->opbufs.begin();it!=p->opbufs.end();it++){
+                    if(!it->second)continue;
+                    MixGraph::Conn c = {p->h,p->p->desc->connect_port,
+                        (unsigned long)it->first,g->buf(it->second)};
+                    g->conns.push_back(c);
+                    g->fxOutputs.push_back(c.buf);
+                    f.numOuts++;
+                }
+                g->fx.push_back(f);
+                r.numFx++;
+            }
+            g->branches.push_back(r);
+        }
+        run.numBranches = g->branches.size()-run.firstBranch;
+        g->chainRuns.push_back(run);
+    }
+    
+    virtual const vector<PluginInstance *>& getEffects(){
+        return fxlist;
+    }
+    
     virtual ChainEditData *createEditData(){
         ChainEditData *d = new ChainEditData();
         vector<PluginInstance *>::iterator it;
@@ -155,10 +281,10 @@ struct Chain : public ChainInterface {
     }
     virtual void save(ostream &out,string name);
     
-    // add a new effect  - from the processing thread!
     virtual void addEffect(PluginData *d,string name);
     
-    void deleteEffect(int idx);
+    // remove an effect, putting it in the graveyard
+    void unlinkEffect(int idx,Graveyard& dead);
     
     virtual void remapInput(std::string instname,
                             std::string inpname,
@@ -173,14 +299,20 @@ struct Chain : public ChainInterface {
 };
 
 
-/// The effects chains are stored as an unordered map of string to chain.
+/// The effects chains are stored as an unordered map of string to chain,
+/// used to find them by name, and in chainlist in the order they are run.
+/// Both are only used outside the process thread.
 
-static unordered_map<string,Chain> chains;
+static unordered_map<string,Chain *> chains;
 
 void ChainInterface::addNewEmptyChain(string n){
-    Chain& chain = chains.emplace(n,Chain()).first->second;
-    chain.name = n;
-    chainlist.push_back(&chain);
+    if(chains.find(n)!=chains.end())
+        throw _("chain %s already exists",n.c_str());
+    Chain *chain = new Chain();
+    chain->name = n;
+    chains[n] = chain;
+    chainlist.push_back(chain);
+    
     string retname = "R"+n;
     Value *g = new Value(n+" ret gain");
     g->setdb()->setdbrange()->setdef(-50)->reset();
@@ -188,27 +320,33 @@ void ChainInterface::addNewEmptyChain(string n){
     p->setrange(0,1)->setdef(0.5)->reset();
     Channel *c = new Channel(retname,2,g,p,true,n);
     c->resolveReturnChannel();
+    c->link();
 }
 
-void ChainInterface::deleteChain(int n){
+void ChainInterface::unlinkChain(int n,Graveyard& dead){
     // assume chaininterfaces are all Chain
     Chain *chain = (Chain *)chainlist[n];
     
     // we need to remove any return channel and sends
-    Channel::removeReturnChannelsAndSends(chain->name);
+    Channel *ret = Channel::removeReturnChannelsAndSends(chain,dead.values);
+    if(ret)
+        dead.chans.push_back(ret);
+    
+    // and the effects' parameters
+    for(unsigned int i=0;i<chain->fxlist.size();i++)
+        chain->fxlist[i]->unlinkValues();
     
-    // remove from the map
-    chains.erase(chain->name);
-    // this should delete/deactivate all the effects
-    // by running the dtor
     chainlist.erase(chainlist.begin()+n);
+    chains.erase(chain->name);
+    // deleting the chain deletes its effects
+    dead.chains.push_back(chain);
 }
 
-void ChainInterface::deleteEffect(int chainidx,int fidx){
+void ChainInterface::unlinkEffect(int chainidx,int fidx,Graveyard& dead){
     // assume chaininterfaces are all Chain
     Chain *chain = (Chain *)chainlist[chainidx];
     
-    chain->deleteEffect(fidx);
+    chain->unlinkEffect(fidx,dead);
 }
 
 
@@ -218,7 +356,7 @@ void parseEffect(Chain &c){
     string label = getnextidentorstring();
     string name =  getnextident();
     
-    if(c.fxmap.find(name)!=c.fxmap.end())
+    if(c.findEffect(name))
         throw _("effect %s already exists in chain",name.c_str());
     
     
@@ -303,7 +441,6 @@ void parseEffect(Chain &c){
     i->activate();
     // add to chain data
     c.fxlist.push_back(i);
-    c.fxmap[name]=i;
 }
 
 void parseStereoChain(){
@@ -316,8 +453,9 @@ void parseStereoChain(){
     
     if(tok.getnext()!=T_OCURLY)expected("'{'");
     
-    Chain& chain = chains.emplace(name,Chain()).first->second;
+    Chain& chain = *new Chain();
     chain.name = name;
+    chains[name] = &chain;
     chainlist.push_back(&chain);
     
     
@@ -333,6 +471,31 @@ void parseStereoChain(){
     if(tok.getnext()!=T_COLON)expected("':'");
     chain.rightoutport = getnextidentorstring();
     
+    // when to suspend the chain, if not the default
+    switch(tok.getnext()){
+    case T_NOSUSPEND:
+        chain.suspendHold = -1;
+        break;
+    case T_SUSPEND:
+        for(;;){
+            int t = tok.getnext();
+            if(t==T_DB)
+                chain.suspendDb = getnextfloat();
+            else if(t==T_HOLD){
+                chain.suspendHold = getnextfloat();
+                if(chain.suspendHold<0)
+                    throw _("suspend hold time cannot be negative");
+            } else {
+                tok.rewind();
+                break;
+            }
+        }
+        break;
+    default:
+        tok.rewind();
+        break;
+    }
+    
     if(tok.getnext()!=T_FX)expected("'fx'");
     
     parseList([&chain]{
@@ -368,17 +531,17 @@ ChainInterface *ChainInterface::find(std::string name){
     if(chains.find(name)==chains.end())
         throw _("chain %s does not exist",name.c_str());
     
-    return &chains[name];
+    return chains[name];
 }
 ChainInterface *ChainInterface::findornull(std::string name){
     if(chains.find(name)==chains.end())
         return NULL;
-    return &chains[name];
+    return chains[name];
 }
 
 vector<string> ChainInterface::getNames(){
     vector<string> names;
-    unordered_map<string,Chain>::iterator it;
+    unordered_map<string,Chain *>::iterator it;
     for(it=chains.begin();it!=chains.end();it++){
         names.push_back(it->first);
     }
@@ -386,27 +549,24 @@ vector<string> ChainInterface::getNames(){
 }
 
 
-
-void ChainInterface::zeroAllInputs(){
-    unordered_map<string,Chain>::iterator it;
-    for(it=chains.begin();it!=chains.end();it++){
-        it->second.zeroInputs();
-    }
-}
-
-void ChainInterface::runAll(unsigned int nframes){
-    unordered_map<string,Chain>::iterator it;
-    for(it=chains.begin();it!=chains.end();it++){
-        it->second.run(nframes);
-    }
-}
-
 void Chain::save(ostream &out,string name){
     out << "  " << name << " {\n";
     
     out << "    " << "out " << leftouteffect << ": \"" << leftoutport << "\"";
     out << ", " << rightouteffect << ": \"" << rightoutport << "\"\n";
     
+    // the suspend settings, only if they're not the defaults
+    if(suspendHold<0)
+        out << "    nosuspend\n";
+    else if(suspendDb!=SUSPENDDB || suspendHold!=SUSPENDHOLD){
+        out << "    suspend";
+        if(suspendDb!=SUSPENDDB)
+            out << " db " << suspendDb;
+        if(suspendHold!=SUSPENDHOLD)
+            out << " hold " << suspendHold;
+        out << "\n";
+    }
+    
     out << "    fx {\n";
     
     vector<string> fxstrs;
@@ -467,11 +627,11 @@ void Chain::save(ostream &out,string name){
 void ChainInterface::saveAll(ostream &out){
     out << "chain {\n";
     
-    unordered_map<string,Chain>::iterator it;
+    unordered_map<string,Chain *>::iterator it;
     vector<string> strs;
     for(it=chains.begin();it!=chains.end();it++){
         stringstream ss;
-        it->second.save(ss,it->first);
+        it->second->save(ss,it->first);
         strs.push_back(ss.str());
     }
     
@@ -481,15 +641,17 @@ void ChainInterface::saveAll(ostream &out){
 }
 
 void Chain::addEffect(PluginData *d,string n){
-    // here we have to add the effect to the chain and also 
-    // revise the input connection structures
+    // here we have to create the effect and also 
+    // the input connection structures
+    
+    if(findEffect(n))
+        throw _("effect %s already exists in chain",n.c_str());
     
     // instantiate the plugin
     PluginInstance *inst = d->instantiate(n,name);
     
-    // add a new input connection data block
+    // make a new input connection data block
     vector<InputConnectionData> *ipdp = new vector<InputConnectionData>();
-    inputConnData.push_back(ipdp);
     
     // set up the input connection data block:
     for(unsigned int i=0;i<d->desc->PortCount;i++){
@@ -507,20 +669,16 @@ void Chain::addEffect(PluginData *d,string n){
             ipd.port = i;
             ipdp->push_back(ipd);
             
-            // and make the actual connection (this is the part done by resolveInputs()
+            // and record the connection (this is the part done by resolveInputs()
             // when loading a file)
-            
-            float *buf = ipd.channel?inpleft:inpright;
-            (*inst->p->desc->connect_port)(inst->h,ipd.port,buf);
-            inst->connections[ipd.port]=buf;
+            inst->inbufs[ipd.port] = ipd.channel?inpright:inpleft;
         }
     }
     
-    // activate the effect
+    // activate the effect and add it to the chain
     inst->activate();
-    // add the effect to the chain
     fxlist.push_back(inst);
-    fxmap[n]=inst;
+    inputConnData.push_back(ipdp);
 }
 
 
@@ -531,11 +689,11 @@ void Chain::remapInput(std::string instname,
                        std::string outinstname,
                        std::string outname){
     // here we go. Get the instance.
-    if(fxmap.find(instname)==fxmap.end())
+    PluginInstance *inst = findEffect(instname);
+    if(!inst)
         return;
     
     // we're going to need both the index and the instance
-    PluginInstance *inst = fxmap[instname];
     int instidx = -1;
     for(unsigned int i=0;i<fxlist.size();i++){
         if(fxlist[i]==inst){
@@ -567,32 +725,30 @@ void Chain::remapInput(std::string instname,
         // do the remap in the IPD
         ipd.channel = chan;
         // and in the actual plugin
-        float *buf;
+        BufferId buf;
         switch(chan){
         case 0:buf=inpleft;break;
         case 1:buf=inpright;break;
-        case 2:buf=zeroBuf;break;
+        default:buf=zeroBuf;break;
         }    
-        (*inst->p->desc->connect_port)(inst->h,portidx,buf);
-        inst->connections[portidx]=buf;
+        inst->inbufs[portidx]=buf;
     } else {
         // otherwise we need to get the effect and port for the output we're
         // coming from
         
-        if(fxmap.find(outinstname)==fxmap.end())
+        PluginInstance *outinst = findEffect(outinstname);
+        if(!outinst)
             throw _("cannot find output inst");
         
         // and find the output port
-        PluginInstance *outinst = fxmap[outinstname];
         int outidx = outinst->p->getPortIdx(outname);
-        float *buf=outinst->opbufs[outidx];
+        BufferId buf=outinst->opbufs[outidx];
         
         // and link
         ipd.channel = -1;
         ipd.fromeffect = outinstname;
         ipd.fromport = outname;
-        (*inst->p->desc->connect_port)(inst->h,portidx,buf);
-        inst->connections[portidx]=buf;
+        inst->inbufs[portidx]=buf;
     }
 }
 
@@ -600,10 +756,10 @@ void Chain::remapOutput(int outchan,
                         std::string instname,
                         std::string port){
     // here we go. Get the instance.
-    if(fxmap.find(instname)==fxmap.end())
+    PluginInstance *inst = findEffect(instname);
+    if(!inst)
         return;
     // we're going to need both the index and the instance
-    PluginInstance *inst = fxmap[instname];
     int instidx = -1;
     for(unsigned int i=0;i<fxlist.size();i++){
         if(fxlist[i]==inst){
@@ -633,11 +789,9 @@ void Chain::remapOutput(int outchan,
         leftouteffect = instname;
         leftoutport = port;
     }
-    Channel::resolveAllChannelChains(); // make sure the return channels are right
-        
 }
 
-void Chain::deleteEffect(int idx){
+void Chain::unlinkEffect(int idx,Graveyard& dead){
     PluginInstance *inst = fxlist[idx];
     
     // first, we need to remove this instance as an input for all instances that
@@ -657,7 +811,7 @@ void Chain::deleteEffect(int idx){
     }
     
     // remove this effect from the input connection list
-    delete inputConnData[idx];
+    dead.conns.push_back(inputConnData[idx]);
     inputConnData.erase(inputConnData.begin()+idx);
     
     // then we need to replace the output buffers with zero if they refer to this.
@@ -673,15 +827,13 @@ void Chain::deleteEffect(int idx){
         rightoutbuf = zeroBuf;
     }
     
-    // remove it from the map
-    fxmap.erase(inst->name);
-    // and from the list
+    // remove it from the list
     fxlist.erase(fxlist.begin()+idx);
-    
-    // now we can delete it.
-    delete inst;
-    
+    inst->unlinkValues();
     
     // and fixup the inputs again
     resolveInputs(false);
+    
+    // it gets deleted once no graph uses it
+    dead.fx.push_back(inst);
 }
@@ -8,64 +8,81 @@
 #define __FX_H
 
 #include <string.h>
+#include <atomic>
 
 #include "utils.h"
 #include "plugins.h"
+#include "mixgraph.h"
+
+struct InputConnectionData;
+class Channel;
+
+// default suspend threshold (dB) and hold time (ms) for chains
+#define SUSPENDDB -90.0f
+#define SUSPENDHOLD 2000.0f
 
 // the interface for FX chains. The chain itself inherits this and builds upon it.
+// Chains, and the effects in them, are part of the model, which is only
+// changed outside the process thread; the process thread runs the
+// effects from a MixGraph (see compile()).
 
 struct ChainInterface {
     std::string name; // name for viewing
     
-    // these are the two input buffers for the chain
-    float inpleft[BUFSIZE],inpright[BUFSIZE];
-    // these are pointers to the output buffers for the two
-    // output ports of the final effect
-    float *leftoutbuf,*rightoutbuf;
-    
-    void zeroInputs(){
-        memset(inpleft,0,BUFSIZE*sizeof(float));
-        memset(inpright,0,BUFSIZE*sizeof(float));
-    }
-    
-    virtual ~ChainInterface(){}
-    
-    
-    // mono chains are currently implemented by adding to both the
-    // left and right input 
-    void addMono(float *v,float gain){
-        addbuffers(inpleft,v,BUFSIZE,gain);
-        addbuffers(inpright,v,BUFSIZE,gain);
-    }
-    
-    void addStereo(float *left,float *right,float gain){
-        addbuffers(inpleft,left,BUFSIZE,gain);
-        addbuffers(inpright,right,BUFSIZE,gain);
-    }
-    
-    // assumes all inputs are filled with data. Runs the fx in order
-    // thus filling the output buffers.
-    virtual void run(unsigned int nframes)=0;
+    // these are the two input buffers for the chain. Like all the
+    // buffers in the model they are IDs, given memory by each MixGraph
+    // (see Arena).
+    BufferId inpleft,inpright;
+    // these are the output buffers for the two output ports of the
+    // final effect
+    BufferId leftoutbuf,rightoutbuf;
+    
+    // how long the chain's effects take in each block, all its
+    // branches together (see profile.h)
+    class ProfStats *prof;
+    
+    // the chain stops running its effects once its inputs have been
+    // silent and its outputs under suspendDb for suspendHold ms, and
+    // outputs silence until there is input again. A negative hold
+    // means it never does.
+    float suspendDb,suspendHold;
+    // written by the process thread: whether the chain is suspended,
+    // and how long it has been quiet for
+    std::atomic<bool> suspended;
+    unsigned int quietFrames;
+    
+    ChainInterface();
+    virtual ~ChainInterface();
+    
+    // add the chain's buffers to a graph being built, which runs the
+    // chain at the given level.
+    virtual void addBuffers(MixGraph *g,int level)=0;
+    
+    // add the chain's input buffers, its effects in run order and
+    // their input connections to a graph being built.
+    virtual void compile(MixGraph *g)=0;
     
     static ChainInterface *find(std::string name);
     static ChainInterface *findornull(std::string name);
     
-    static void zeroAllInputs();
-    
-    // run all effect chains in the order in which they were created.
-    static void runAll(unsigned int n);
-    
     // get names of all chains
     static std::vector<std::string> getNames();
     
     
     void save(std::ostream &out,std::string name);
     static void saveAll(std::ostream &out);
+    
+    // create a new empty chain and its return channel, and link
+    // them both in. Throws if the name is taken.
     static void addNewEmptyChain(std::string n);
-    // delete chain by idx in chainlist
-    static void deleteChain(int n);
     
-    static void deleteEffect(int chainidx,int fidx);
+    // remove chain by idx in chainlist, with its return channel and
+    // sends. They all go into the graveyard given.
+    static void unlinkChain(int n,Graveyard& dead);
+    
+    // remove an effect from a chain; it goes into the graveyard given
+    // with its connection data.
+    static void unlinkEffect(int chainidx,int fidx,Graveyard& dead);
     
     // generate a structure containing the connection and parameter data
     // for all fx in the chain, for editing. Messy, slightly, but it means
@@ -73,10 +90,16 @@ struct ChainInterface {
     
     virtual struct ChainEditData *createEditData()=0;
     
-    // add a new effect on the fly
+    // the effects, in the order they were added
+    virtual const std::vector<PluginInstance *>& getEffects()=0;
+    
+    // add a new effect instance to the end of the chain, taking its
+    // audio inputs from the chain inputs, and activate it. Throws on
+    // failure.
     virtual void addEffect(PluginData *d,string name)=0;
     
-    // remap an input on the fly (that poor fly)
+    // remap an input on the fly (that poor fly). Like all the
+    // changes here, it takes effect in the next graph built.
     virtual void remapInput(std::string instname,
                             std::string inpname,
                             int chan, // 0/1 for chain inputs, -1 for another effect
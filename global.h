@@ -7,7 +7,9 @@
 #ifndef __GLOBAL_H
 #define __GLOBAL_H
 
-// largest chunk we can work on (size of temp buffers)
+// largest chunk we can work on (size of temp buffers). Chain and
+// effect buffers are only as big as the period (see Process::bufsize),
+// and periods longer than this are split.
 #define BUFSIZE 1024
 
 
@@ -27,10 +27,12 @@ static const char *MainHelpCol1[] = {
     "{q}        - quit",
     "{s}        - solo channel",
     "{m}        - mute channel",
+    "{l}        - loudness meter on/off",
     "{g}        - set gain",
     "{p}        - set pan",
     "{c}        - chain editor",
     "{C}        - controller editor",
+    "{P}        - DSP profile",
     "{ENTER}    - edit channel",
     "{w}        - write config to file",
     "",
@@ -80,6 +82,13 @@ static const char *MainHelpCol2[] = {
     "{DEL}      - delete ctrl/val. link",
     "{r}        - set/reset input range",
     "{a}        - add new controller",
+    "",
+    "[        DSP profile]",
+    "{ENTER/q}  - return",
+    "{t}        - chains/top consumers",
+    "{o}        - change sort order",
+    "{r}        - reset counters",
+    "{d}        - check for subnormals",
     
     NULL
 };
@@ -0,0 +1,297 @@
+/**
+ * @file kernels.cpp
+ * @brief Vectorised mixing kernels. Each kernel set is compiled for its
+ * own instruction set with target attributes, and the best one the CPU
+ * supports is picked at startup.
+ *
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define X86KERNELS 1
+#include <immintrin.h>
+#endif
+
+// the plain C version, used where nothing better is available and
+// for the tails of the vector versions, adding to the levels so far.
+
+static inline void mixScalarRange(const float *xl,const float *xr,int start,int n,
+                                  const MixDest *dests,int ndests,
+                                  BlockLevels *lvl,BlockLevels *lvr){
+    float ml = lvl->peak, mr = lvr->peak;
+    float sl = lvl->sumsq, sr = lvr->sumsq;
+    int cl = lvl->clips, cr = lvr->clips;
+    for(int i=start;i<n;i++){
+        float a = xl[i], b = xr[i];
+        float fa = fabsf(a), fb = fabsf(b);
+        if(fa>ml)ml=fa;
+        if(fb>mr)mr=fb;
+        sl += a*a;
+        sr += b*b;
+        cl += fa>=1.0f;
+        cr += fb>=1.0f;
+        for(int d=0;d<ndests;d++){
+            const MixDest& dd = dests[d];
+            dd.l[i] += a*(dd.gl+i*dd.dgl);
+            dd.r[i] += b*(dd.gr+i*dd.dgr);
+        }
+    }
+    lvl->peak = ml; lvr->peak = mr;
+    lvl->sumsq = sl; lvr->sumsq = sr;
+    lvl->clips = cl; lvr->clips = cr;
+}
+
+static void mixScalar(const float *xl,const float *xr,int n,
+                      const MixDest *dests,int ndests,
+                      BlockLevels *lvl,BlockLevels *lvr){
+    lvl->peak = lvr->peak = 0;
+    lvl->sumsq = lvr->sumsq = 0;
+    lvl->clips = lvr->clips = 0;
+    mixScalarRange(xl,xr,0,n,dests,ndests,lvl,lvr);
+}
+
+// combine the lanes of the vector accumulators into the levels
+static inline void reduceLevels(const float *ml,const float *sl,const int *cl,
+                                int lanes,BlockLevels *lv){
+    lv->peak = lv->sumsq = 0;
+    lv->clips = 0;
+    for(int j=0;j<lanes;j++){
+        if(ml[j]>lv->peak)lv->peak=ml[j];
+        lv->sumsq += sl[j];
+        lv->clips += cl[j];
+    }
+}
+
+#if X86KERNELS
+
+__attribute__((target("sse2")))
+static void mixSSE2(const float *xl,const float *xr,int n,
+                    const MixDest *dests,int ndests,
+                    BlockLevels *lvl,BlockLevels *lvr){
+    const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 one = _mm_set1_ps(1.0f);
+    // gains are base+index*increment, with the index of each lane
+    // held as a float vector.
+    __m128 gl[MAXMIXDESTS],gr[MAXMIXDESTS],dgl[MAXMIXDESTS],dgr[MAXMIXDESTS];
+    for(int d=0;d<ndests;d++){
+        gl[d] = _mm_set1_ps(dests[d].gl);
+        gr[d] = _mm_set1_ps(dests[d].gr);
+        dgl[d] = _mm_set1_ps(dests[d].dgl);
+        dgr[d] = _mm_set1_ps(dests[d].dgr);
+    }
+    __m128 ml = _mm_setzero_ps(), mr = _mm_setzero_ps();
+    __m128 sl = _mm_setzero_ps(), sr = _mm_setzero_ps();
+    // clip counts per lane, subtracting the all-ones compare results
+    __m128i cl = _mm_setzero_si128(), cr = _mm_setzero_si128();
+    __m128 idx = _mm_setr_ps(0,1,2,3);
+    const __m128 step = _mm_set1_ps(4);
+    int i;
+    for(i=0;i+4<=n;i+=4){
+        __m128 a = _mm_loadu_ps(xl+i);
+        __m128 b = _mm_loadu_ps(xr+i);
+        __m128 fa = _mm_and_ps(a,absmask);
+        __m128 fb = _mm_and_ps(b,absmask);
+        ml = _mm_max_ps(ml,fa);
+        mr = _mm_max_ps(mr,fb);
+        sl = _mm_add_ps(sl,_mm_mul_ps(a,a));
+        sr = _mm_add_ps(sr,_mm_mul_ps(b,b));
+        cl = _mm_sub_epi32(cl,_mm_castps_si128(_mm_cmpge_ps(fa,one)));
+        cr = _mm_sub_epi32(cr,_mm_castps_si128(_mm_cmpge_ps(fb,one)));
+        for(int d=0;d<ndests;d++){
+            float *l = dests[d].l+i;
+            float *r = dests[d].r+i;
+            __m128 g = _mm_add_ps(gl[d],_mm_mul_ps(idx,dgl[d]));
+            _mm_storeu_ps(l,_mm_add_ps(_mm_loadu_ps(l),_mm_mul_ps(a,g)));
+            g = _mm_add_ps(gr[d],_mm_mul_ps(idx,dgr[d]));
+            _mm_storeu_ps(r,_mm_add_ps(_mm_loadu_ps(r),_mm_mul_ps(b,g)));
+        }
+        idx = _mm_add_ps(idx,step);
+    }
+    float tl[4],tr[4],ul[4],ur[4];
+    int vl[4],vr[4];
+    _mm_storeu_ps(tl,ml);
+    _mm_storeu_ps(tr,mr);
+    _mm_storeu_ps(ul,sl);
+    _mm_storeu_ps(ur,sr);
+    _mm_storeu_si128((__m128i *)vl,cl);
+    _mm_storeu_si128((__m128i *)vr,cr);
+    reduceLevels(tl,ul,vl,4,lvl);
+    reduceLevels(tr,ur,vr,4,lvr);
+    mixScalarRange(xl,xr,i,n,dests,ndests,lvl,lvr);
+}
+
+__attribute__((target("avx2,fma")))
+static void mixAVX2(const float *xl,const float *xr,int n,
+                    const MixDest *dests,int ndests,
+                    BlockLevels *lvl,BlockLevels *lvr){
+    const __m256 absmask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256 one = _mm256_set1_ps(1.0f);
+    __m256 gl[MAXMIXDESTS],gr[MAXMIXDESTS],dgl[MAXMIXDESTS],dgr[MAXMIXDESTS];
+    for(int d=0;d<ndests;d++){
+        gl[d] = _mm256_set1_ps(dests[d].gl);
+        gr[d] = _mm256_set1_ps(dests[d].gr);
+        dgl[d] = _mm256_set1_ps(dests[d].dgl);
+        dgr[d] = _mm256_set1_ps(dests[d].dgr);
+    }
+    __m256 ml = _mm256_setzero_ps(), mr = _mm256_setzero_ps();
+    __m256 sl = _mm256_setzero_ps(), sr = _mm256_setzero_ps();
+    __m256i cl = _mm256_setzero_si256(), cr = _mm256_setzero_si256();
+    __m256 idx = _mm256_setr_ps(0,1,2,3,4,5,6,7);
+    const __m256 step = _mm256_set1_ps(8);
+    int i;
+    for(i=0;i+8<=n;i+=8){
+        __m256 a = _mm256_loadu_ps(xl+i);
+        __m256 b = _mm256_loadu_ps(xr+i);
+        __m256 fa = _mm256_and_ps(a,absmask);
+        __m256 fb = _mm256_and_ps(b,absmask);
+        ml = _mm256_max_ps(ml,fa);
+        mr = _mm256_max_ps(mr,fb);
+        sl = _mm256_fmadd_ps(a,a,sl);
+        sr = _mm256_fmadd_ps(b,b,sr);
+        cl = _mm256_sub_epi32(cl,_mm256_castps_si256(_mm256_cmp_ps(fa,one,_CMP_GE_OQ)));
+        cr = _mm256_sub_epi32(cr,_mm256_castps_si256(_mm256_cmp_ps(fb,one,_CMP_GE_OQ)));
+        for(int d=0;d<ndests;d++){
+            float *l = dests[d].l+i;
+            float *r = dests[d].r+i;
+            __m256 g = _mm256_fmadd_ps(idx,dgl[d],gl[d]);
+            _mm256_storeu_ps(l,_mm256_fmadd_ps(a,g,_mm256_loadu_ps(l)));
+            g = _mm256_fmadd_ps(idx,dgr[d],gr[d]);
+            _mm256_storeu_ps(r,_mm256_fmadd_ps(b,g,_mm256_loadu_ps(r)));
+        }
+        idx = _mm256_add_ps(idx,step);
+    }
+    float tl[8],tr[8],ul[8],ur[8];
+    int vl[8],vr[8];
+    _mm256_storeu_ps(tl,ml);
+    _mm256_storeu_ps(tr,mr);
+    _mm256_storeu_ps(ul,sl);
+    _mm256_storeu_ps(ur,sr);
+    _mm256_storeu_si256((__m256i *)vl,cl);
+    _mm256_storeu_si256((__m256i *)vr,cr);
+    reduceLevels(tl,ul,vl,8,lvl);
+    reduceLevels(tr,ur,vr,8,lvr);
+    mixScalarRange(xl,xr,i,n,dests,ndests,lvl,lvr);
+}
+
+// some gcc versions warn about _mm512_undefined_ps() inside _mm512_max_ps()
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f")))
+static void mixAVX512(const float *xl,const float *xr,int n,
+                      const MixDest *dests,int ndests,
+                      BlockLevels *lvl,BlockLevels *lvr){
+    // integer and, because the float one needs AVX512DQ
+    const __m512i absmask = _mm512_set1_epi32(0x7fffffff);
+    const __m512 one = _mm512_set1_ps(1.0f);
+    __m512 gl[MAXMIXDESTS],gr[MAXMIXDESTS],dgl[MAXMIXDESTS],dgr[MAXMIXDESTS];
+    for(int d=0;d<ndests;d++){
+        gl[d] = _mm512_set1_ps(dests[d].gl);
+        gr[d] = _mm512_set1_ps(dests[d].gr);
+        dgl[d] = _mm512_set1_ps(dests[d].dgl);
+        dgr[d] = _mm512_set1_ps(dests[d].dgr);
+    }
+    __m512 ml = _mm512_setzero_ps(), mr = _mm512_setzero_ps();
+    __m512 sl = _mm512_setzero_ps(), sr = _mm512_setzero_ps();
+    __m512i cl = _mm512_setzero_si512(), cr = _mm512_setzero_si512();
+    const __m512i ones = _mm512_set1_epi32(1);
+    __m512 idx = _mm512_setr_ps(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15);
+    const __m512 step = _mm512_set1_ps(16);
+    // the tail is done with a masked final pass rather than in scalar;
+    // the masked-off lanes load as zero, so don't affect the levels.
+    for(int i=0;i<n;i+=16){
+        __mmask16 m = (n-i>=16) ? 0xffff : (__mmask16)((1u<<(n-i))-1);
+        __m512 a = _mm512_maskz_loadu_ps(m,xl+i);
+        __m512 b = _mm512_maskz_loadu_ps(m,xr+i);
+        __m512 fa = _mm512_castsi512_ps(
+            _mm512_and_si512(_mm512_castps_si512(a),absmask));
+        __m512 fb = _mm512_castsi512_ps(
+            _mm512_and_si512(_mm512_castps_si512(b),absmask));
+        ml = _mm512_max_ps(ml,fa);
+        mr = _mm512_max_ps(mr,fb);
+        sl = _mm512_fmadd_ps(a,a,sl);
+        sr = _mm512_fmadd_ps(b,b,sr);
+        cl = _mm512_mask_add_epi32(cl,_mm512_cmp_ps_mask(fa,one,_CMP_GE_OQ),cl,ones);
+        cr = _mm512_mask_add_epi32(cr,_mm512_cmp_ps_mask(fb,one,_CMP_GE_OQ),cr,ones);
+        for(int d=0;d<ndests;d++){
+            float *l = dests[d].l+i;
+            float *r = dests[d].r+i;
+            __m512 g = _mm512_fmadd_ps(idx,dgl[d],gl[d]);
+            _mm512_mask_storeu_ps(l,m,_mm512_fmadd_ps(a,g,_mm512_maskz_loadu_ps(m,l)));
+            g = _mm512_fmadd_ps(idx,dgr[d],gr[d]);
+            _mm512_mask_storeu_ps(r,m,_mm512_fmadd_ps(b,g,_mm512_maskz_loadu_ps(m,r)));
+        }
+        idx = _mm512_add_ps(idx,step);
+    }
+    float tl[16],tr[16],ul[16],ur[16];
+    int vl[16],vr[16];
+    _mm512_storeu_ps(tl,ml);
+    _mm512_storeu_ps(tr,mr);
+    _mm512_storeu_ps(ul,sl);
+    _mm512_storeu_ps(ur,sr);
+    _mm512_storeu_si512(vl,cl);
+    _mm512_storeu_si512(vr,cr);
+    reduceLevels(tl,ul,vl,16,lvl);
+    reduceLevels(tr,ur,vr,16,lvr);
+}
+#pragma GCC diagnostic pop
+
+#endif
+
+namespace Kernels {
+
+const char *names[] = {"scalar","sse2","avx2","avx512",NULL};
+
+static const char *current = "scalar";
+
+// can this CPU run a kernel set?
+static bool supported(const char *name){
+    if(!strcmp(name,"scalar"))return true;
+#if X86KERNELS
+    __builtin_cpu_init();
+    if(!strcmp(name,"sse2"))
+        return __builtin_cpu_supports("sse2");
+    if(!strcmp(name,"avx2"))
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if(!strcmp(name,"avx512"))
+        return __builtin_cpu_supports("avx512f");
+#endif
+    return false;
+}
+
+bool select(const char *name){
+    if(!supported(name))return false;
+    MixFunc f = mixScalar;
+#if X86KERNELS
+    if(!strcmp(name,"sse2"))f = mixSSE2;
+    else if(!strcmp(name,"avx2"))f = mixAVX2;
+    else if(!strcmp(name,"avx512"))f = mixAVX512;
+#endif
+    mix = f;
+    current = name;
+    return true;
+}
+
+// pick the best kernel set, i.e. the last supported one in the list,
+// unless JACKMIX_KERNEL names one.
+static MixFunc choose(){
+    mix = mixScalar;
+    for(int i=0;names[i];i++)
+        select(names[i]);
+    const char *env = getenv("JACKMIX_KERNEL");
+    if(env)
+        select(env);
+    return mix;
+}
+
+MixFunc mix = choose();
+
+const char *getName(){
+    return current;
+}
+
+}
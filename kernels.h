@@ -0,0 +1,111 @@
+/**
+ * @file kernels.h
+ * @brief Vectorised mixing kernels, with the implementation chosen
+ * at startup from the CPU's capabilities.
+ *
+ */
+
+#ifndef __KERNELS_H
+#define __KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+
+// a stereo destination for the fused mixer. The gains ramp linearly
+// across the block: the kernel does l[i] += xl[i]*(gl+i*dgl) and
+// r[i] += xr[i]*(gr+i*dgr).
+struct MixDest {
+    float *l,*r;
+    float gl,gr;
+    float dgl,dgr;
+    
+    /// set the gains, which go from gl0,gr0 at the start of the period
+    /// to gl1,gr1 at the end, for a block starting at frame offset.
+    void setRamp(float gl0,float gr0,float gl1,float gr1,
+                 int offset,int period){
+        dgl = (gl1-gl0)/period;
+        dgr = (gr1-gr0)/period;
+        gl = gl0+dgl*offset;
+        gr = gr0+dgr*offset;
+    }
+};
+
+// the most destinations the fused mixer takes in one call; callers
+// with more should split them up.
+#define MAXMIXDESTS 16
+
+/// the levels of one input channel over a block, for the meters
+struct BlockLevels {
+    /// largest absolute value
+    float peak;
+    /// sum of the squares of the samples
+    float sumsq;
+    /// how many samples were at or over full scale
+    int clips;
+};
+
+/// mix a stereo input (xr may equal xl for mono) into a number of
+/// destinations in one pass over the input, and measure the levels
+/// of each input channel for the meters.
+typedef void (*MixFunc)(const float *xl,const float *xr,int n,
+                        const MixDest *dests,int ndests,
+                        BlockLevels *lvl,BlockLevels *lvr);
+
+namespace Kernels {
+/// the mixer in use, set up at startup.
+extern MixFunc mix;
+
+/// just measure the levels of a stereo block
+inline void levels(const float *xl,const float *xr,int n,
+                   BlockLevels *lvl,BlockLevels *lvr){
+    (*mix)(xl,xr,n,NULL,0,lvl,lvr);
+}
+
+/// true if a block is digital silence (zeros of either sign). Looks
+/// at 16 samples at a time, which gcc does in vector registers.
+inline bool silent(const float *x,int n){
+    typedef uint32_t v4u __attribute__((vector_size(16),aligned(4),may_alias));
+    const v4u *v = (const v4u *)x;
+    int i=0;
+    for(;i+16<=n;i+=16,v+=4){
+        v4u a = (v[0]|v[1]|v[2]|v[3])<<1;
+        if(a[0]|a[1]|a[2]|a[3])
+            return false;
+    }
+    const uint32_t *p __attribute__((may_alias)) = (const uint32_t *)x;
+    uint32_t a=0;
+    for(;i<n;i++)
+        a|=p[i];
+    return !(a<<1);
+}
+
+/// true if every sample of a block is smaller than a level
+inline bool below(const float *x,int n,float level){
+    int over=0;
+    for(int i=0;i<n;i++)
+        over |= fabsf(x[i])>=level;
+    return !over;
+}
+
+/// how many samples of a block are subnormal (denormal)
+inline int subnormals(const float *x,int n){
+    const uint32_t *p __attribute__((may_alias)) = (const uint32_t *)x;
+    int c=0;
+    for(int i=0;i<n;i++)
+        c += !(p[i]&0x7f800000) & !!(p[i]&0x7fffff);
+    return c;
+}
+
+/// name of the kernel set in use ("scalar", "sse2", "avx2", "avx512")
+const char *getName();
+
+/// force a particular kernel set by name, returning false if it
+/// isn't known or the CPU can't run it. Used in benchmarking.
+bool select(const char *name);
+
+/// null-terminated list of all kernel set names
+extern const char *names[];
+}
+
+#endif /* __KERNELS_H */
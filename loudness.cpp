@@ -0,0 +1,329 @@
+/**
+ * @file loudness.cpp
+ * @brief EBU R128 / ITU-R BS.1770 loudness and true-peak measurement.
+ * The filters work on both channels (and the four oversampling phases)
+ * at once using gcc's vector extensions.
+ *
+ */
+
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <atomic>
+#include <algorithm>
+
+#include "loudness.h"
+#include "exception.h"
+
+using namespace std;
+
+typedef double v2df __attribute__((vector_size(16)));
+typedef float v4sf __attribute__((vector_size(16)));
+
+// the oversampling filter: taps per phase, and phases
+#define TPTAPS 12
+#define TPPHASES 4
+
+LoudnessTap *Loudness::master=NULL;
+unsigned int Loudness::samprate=48000;
+
+// the taps being processed, and the lock on them and their readings
+static vector<LoudnessTap *> taps;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t thread;
+static bool threadRunning=false;
+static std::atomic<bool> quit(false);
+
+// frames in a 100ms block
+static int blockFrames=4800;
+// K-weighting coefficients, b0,b1,b2,a1,a2 of the shelf and high-pass
+static double shelfCoeffs[5],hpfCoeffs[5];
+// the oversampling filter, each tap for all the phases
+static v4sf tpCoeffs[TPTAPS];
+
+static float toLUFS(double energy){
+    if(energy<=0)return LOUDNESS_NONE;
+    return (float)(-0.691+10.0*log10(energy));
+}
+
+static float todB(float v){
+    if(v<=0)return LOUDNESS_NONE;
+    return 20.0f*log10f(v);
+}
+
+// the K-weighting filters from BS.1770, worked out for any sample
+// rate rather than just 48k
+static void makeCoeffs(unsigned int rate){
+    double f0 = 1681.974450955533;
+    double G = 3.999843853973347;
+    double Q = 0.7071752369554196;
+    double K = tan(M_PI*f0/rate);
+    double Vh = pow(10.0,G/20.0);
+    double Vb = pow(Vh,0.4996667741545416);
+    double a0 = 1.0+K/Q+K*K;
+    shelfCoeffs[0] = (Vh+Vb*K/Q+K*K)/a0;
+    shelfCoeffs[1] = 2.0*(K*K-Vh)/a0;
+    shelfCoeffs[2] = (Vh-Vb*K/Q+K*K)/a0;
+    shelfCoeffs[3] = 2.0*(K*K-1.0)/a0;
+    shelfCoeffs[4] = (1.0-K/Q+K*K)/a0;
+
+    f0 = 38.13547087602444;
+    Q = 0.5003270373238773;
+    K = tan(M_PI*f0/rate);
+    a0 = 1.0+K/Q+K*K;
+    hpfCoeffs[0] = 1.0;
+    hpfCoeffs[1] = -2.0;
+    hpfCoeffs[2] = 1.0;
+    hpfCoeffs[3] = 2.0*(K*K-1.0)/a0;
+    hpfCoeffs[4] = (1.0-K/Q+K*K)/a0;
+
+    // windowed sinc interpolator, each phase normalised for unity
+    // gain at DC
+    const int n = TPTAPS*TPPHASES;
+    float h[n];
+    for(int k=0;k<n;k++){
+        double t = (k-(n-1)*0.5)/TPPHASES;
+        double sinc = fabs(t)<1e-9 ? 1.0 : sin(M_PI*t)/(M_PI*t);
+        double w = 0.42-0.5*cos(2*M_PI*(k+0.5)/n)+0.08*cos(4*M_PI*(k+0.5)/n);
+        h[k] = (float)(sinc*w);
+    }
+    for(int p=0;p<TPPHASES;p++){
+        float sum=0;
+        for(int j=0;j<TPTAPS;j++)
+            sum+=h[j*TPPHASES+p];
+        for(int j=0;j<TPTAPS;j++)
+            tpCoeffs[j][p] = h[j*TPPHASES+p]/sum;
+    }
+}
+
+LoudnessTap::LoudnessTap(unsigned int id){
+    // about a second of stereo, so the loudness thread can fall
+    // well behind
+    ring = jack_ringbuffer_create(Loudness::samprate*2*sizeof(float));
+    if(!ring)
+        throw _("cannot create loudness tap");
+    memset(kstate,0,sizeof(kstate));
+    energy=0;
+    frames=0;
+    peak=0;
+    numBlocks=nextBlock=0;
+    memset(blockEnergy,0,sizeof(blockEnergy));
+    memset(blockPeak,0,sizeof(blockPeak));
+    memset(gateCount,0,sizeof(gateCount));
+    memset(gateEnergy,0,sizeof(gateEnergy));
+    memset(hist,0,sizeof(hist));
+    histPos=0;
+    maxPeak=0;
+    reading.id = id;
+    reading.momentary = reading.shortterm = reading.integrated = LOUDNESS_NONE;
+    reading.truepeak = reading.maxtruepeak = LOUDNESS_NONE;
+}
+
+LoudnessTap::~LoudnessTap(){
+    jack_ringbuffer_free(ring);
+}
+
+void LoudnessTap::write(const float *l,const float *r,int n,
+                        float gl0,float gr0,float gl1,float gr1,
+                        int offset,int period){
+    jack_ringbuffer_data_t v[2];
+    jack_ringbuffer_get_write_vector(ring,v);
+    // frames never straddle the two parts, as everything written is
+    // whole frames
+    int n0 = v[0].len/(2*sizeof(float));
+    int n1 = v[1].len/(2*sizeof(float));
+    if(n>n0+n1)n=n0+n1;
+
+    float dgl = (gl1-gl0)/period;
+    float dgr = (gr1-gr0)/period;
+    float *out = (float *)v[0].buf;
+    for(int i=0;i<n;i++){
+        if(i==n0)
+            out = (float *)v[1].buf;
+        *out++ = l[i]*(gl0+(offset+i)*dgl);
+        *out++ = r[i]*(gr0+(offset+i)*dgr);
+    }
+    jack_ringbuffer_write_advance(ring,n*2*sizeof(float));
+}
+
+inline float LoudnessTap::truePeak(int ch,float x){
+    float *w = hist[ch]+histPos;
+    w[0] = w[TPTAPS] = x;
+    v4sf acc = {0,0,0,0};
+    for(int j=0;j<TPTAPS;j++)
+        acc += tpCoeffs[j]*w[j];
+    float m = 0;
+    for(int p=0;p<TPPHASES;p++)
+        m = max(m,fabsf(acc[p]));
+    return m;
+}
+
+void LoudnessTap::processFrames(const float *x,int n){
+    const v2df sb0 = {shelfCoeffs[0],shelfCoeffs[0]};
+    const v2df sb1 = {shelfCoeffs[1],shelfCoeffs[1]};
+    const v2df sb2 = {shelfCoeffs[2],shelfCoeffs[2]};
+    const v2df sa1 = {shelfCoeffs[3],shelfCoeffs[3]};
+    const v2df sa2 = {shelfCoeffs[4],shelfCoeffs[4]};
+    const v2df ha1 = {hpfCoeffs[3],hpfCoeffs[3]};
+    const v2df ha2 = {hpfCoeffs[4],hpfCoeffs[4]};
+    v2df s[8];
+    for(int k=0;k<8;k++){
+        s[k][0] = kstate[k][0];
+        s[k][1] = kstate[k][1];
+    }
+
+    for(int i=0;i<n;i++,x+=2){
+        v2df in = {x[0],x[1]};
+        v2df y = sb0*in+sb1*s[0]+sb2*s[1]-sa1*s[2]-sa2*s[3];
+        s[1]=s[0]; s[0]=in;
+        s[3]=s[2]; s[2]=y;
+        // the high-pass's numerator is 1,-2,1
+        v2df z = y-2.0*s[4]+s[5]-ha1*s[6]-ha2*s[7];
+        s[5]=s[4]; s[4]=y;
+        s[7]=s[6]; s[6]=z;
+        v2df sq = z*z;
+        energy += sq[0]+sq[1];
+
+        histPos = (histPos+TPTAPS-1)%TPTAPS;
+        peak = max(peak,max(truePeak(0,x[0]),truePeak(1,x[1])));
+
+        if(++frames==blockFrames)
+            endBlock();
+    }
+
+    for(int k=0;k<8;k++){
+        // flush denormals out of the recursive state
+        kstate[k][0] = fabs(s[k][0])<1e-30 ? 0 : s[k][0];
+        kstate[k][1] = fabs(s[k][1])<1e-30 ? 0 : s[k][1];
+    }
+}
+
+void LoudnessTap::endBlock(){
+    blockEnergy[nextBlock] = energy/frames;
+    blockPeak[nextBlock] = peak;
+    nextBlock = (nextBlock+1)%30;
+    numBlocks++;
+    energy=0;
+    frames=0;
+    maxPeak = max(maxPeak,peak);
+    peak=0;
+
+    // the momentary loudness is over the last 400ms, the short-term
+    // over the last 3s, or however much there is so far.
+    int have = numBlocks<30 ? numBlocks : 30;
+    double e=0;
+    float tp=0;
+    for(int i=0;i<have;i++){
+        int b = (nextBlock+29-i)%30;
+        if(i<4)
+            e += blockEnergy[b];
+        if(i==3){
+            reading.momentary = toLUFS(e/4);
+            // this is also the latest 400ms gating block for the
+            // integrated loudness, if it's over the -70 LUFS gate
+            if(reading.momentary>-70.0f){
+                int bin = (int)((reading.momentary+70.0f)*10.0f);
+                if(bin>749)bin=749;
+                gateCount[bin]++;
+                gateEnergy[bin]+=e/4;
+            }
+        }
+        tp = max(tp,blockPeak[b]);
+    }
+    if(have>=4){
+        e=0;
+        for(int i=0;i<have;i++)
+            e+=blockEnergy[i];
+        reading.shortterm = toLUFS(e/have);
+    }
+    reading.truepeak = todB(tp);
+    reading.maxtruepeak = todB(maxPeak);
+
+    // integrated: the blocks within 10LU of the loudness of all those
+    // over the absolute gate
+    unsigned int count=0;
+    e=0;
+    for(int i=0;i<750;i++){
+        count+=gateCount[i];
+        e+=gateEnergy[i];
+    }
+    if(count){
+        float rel = toLUFS(e/count)-10.0f;
+        int first = (int)ceilf((rel+70.0f)*10.0f);
+        if(first<0)first=0;
+        count=0;
+        e=0;
+        for(int i=first;i<750;i++){
+            count+=gateCount[i];
+            e+=gateEnergy[i];
+        }
+        reading.integrated = count ? toLUFS(e/count) : LOUDNESS_NONE;
+    }
+}
+
+static void *threadFunc(void *){
+    while(!quit.load()){
+        usleep(20000);
+        Loudness::process();
+    }
+    return NULL;
+}
+
+void Loudness::init(unsigned int rate,bool thread){
+    samprate = rate;
+    blockFrames = rate/10;
+    makeCoeffs(rate);
+    master = new LoudnessTap(0);
+    add(master);
+    if(thread){
+        quit.store(false);
+        if(pthread_create(&::thread,NULL,threadFunc,NULL))
+            throw _("cannot start loudness thread");
+        threadRunning=true;
+    }
+}
+
+void Loudness::shutdown(){
+    if(threadRunning){
+        quit.store(true);
+        pthread_join(thread,NULL);
+        threadRunning=false;
+    }
+}
+
+void Loudness::add(LoudnessTap *t){
+    pthread_mutex_lock(&mutex);
+    taps.push_back(t);
+    pthread_mutex_unlock(&mutex);
+}
+
+void Loudness::remove(LoudnessTap *t){
+    pthread_mutex_lock(&mutex);
+    taps.erase(std::remove(taps.begin(),taps.end(),t),taps.end());
+    pthread_mutex_unlock(&mutex);
+}
+
+void Loudness::process(){
+    pthread_mutex_lock(&mutex);
+    for(unsigned int i=0;i<taps.size();i++){
+        LoudnessTap *t = taps[i];
+        jack_ringbuffer_data_t v[2];
+        jack_ringbuffer_get_read_vector(t->ring,v);
+        for(int k=0;k<2;k++){
+            int n = v[k].len/(2*sizeof(float));
+            if(n)
+                t->processFrames((const float *)v[k].buf,n);
+            jack_ringbuffer_read_advance(t->ring,n*2*sizeof(float));
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+void Loudness::getReadings(vector<LoudnessReading>& out){
+    out.clear();
+    pthread_mutex_lock(&mutex);
+    for(unsigned int i=0;i<taps.size();i++)
+        out.push_back(taps[i]->reading);
+    pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,106 @@
+/**
+ * @file loudness.h
+ * @brief EBU R128 loudness (momentary, short-term and integrated) and
+ * true-peak metering of the master and of selected channels. The process
+ * thread only copies the audio into a tap; the filtering is done by a
+ * separate, non-realtime thread.
+ *
+ */
+
+#ifndef __LOUDNESS_H
+#define __LOUDNESS_H
+
+#include <vector>
+
+extern "C" {
+#include <jack/ringbuffer.h>
+}
+
+/// a reading which isn't available yet (less than a block of audio,
+/// or everything gated out)
+#define LOUDNESS_NONE (-1000.0f)
+
+/// the readings from a tap, in LUFS and dBTP
+struct LoudnessReading {
+    /// the channel's ID, 0 for the master
+    unsigned int id;
+    float momentary,shortterm,integrated;
+    /// the highest true peak in the last 3 seconds, and ever
+    float truepeak,maxtruepeak;
+};
+
+/// stereo audio on its way from the process thread to the loudness
+/// thread, and the loudness thread's state for measuring it.
+class LoudnessTap {
+    friend struct Loudness;
+    // interleaved stereo frames, about a second's worth
+    jack_ringbuffer_t *ring;
+
+    // K-weighting filter state for both channels: x1,x2,y1,y2 of
+    // the shelf and then of the high-pass
+    double kstate[8][2];
+    // the 100ms block being measured
+    double energy;
+    int frames;
+    float peak;
+    // the last 3s of block energies and true peaks, for the momentary
+    // and short-term loudness
+    double blockEnergy[30];
+    float blockPeak[30];
+    int numBlocks,nextBlock;
+    // 400ms gating blocks above the absolute gate, in 0.1LU bins:
+    // how many and their total energy
+    unsigned int gateCount[750];
+    double gateEnergy[750];
+    // the oversampling filter's history for each channel, twice over
+    // so that the last 12 samples are always contiguous
+    float hist[2][24];
+    int histPos;
+    float maxPeak;
+
+    LoudnessReading reading;
+
+    void processFrames(const float *x,int n);
+    void endBlock();
+    // true peak of a sample, given the history
+    float truePeak(int ch,float x);
+public:
+    /// make a tap for a channel (0 for the master). Loudness::init()
+    /// must have been called.
+    LoudnessTap(unsigned int id);
+    ~LoudnessTap();
+
+    /// called from the process thread: add n frames, to which the
+    /// gains ramping from gl0,gr0 to gl1,gr1 over period frames,
+    /// starting offset frames into the ramp, are applied. Frames which
+    /// don't fit are dropped.
+    void write(const float *l,const float *r,int n,
+               float gl0,float gr0,float gl1,float gr1,
+               int offset,int period);
+};
+
+struct Loudness {
+    /// set up for a sample rate and make the master's tap. If thread
+    /// is true, start a thread to process the taps; otherwise the
+    /// caller should call process() regularly.
+    static void init(unsigned int samprate,bool thread);
+    /// stop the thread, if any
+    static void shutdown();
+
+    /// add a tap to be processed, or remove one; it must not be
+    /// deleted until it is removed. Not from the process thread.
+    static void add(LoudnessTap *t);
+    static void remove(LoudnessTap *t);
+
+    /// process the audio in all the taps
+    static void process();
+
+    /// get the latest readings of all the taps
+    static void getReadings(std::vector<LoudnessReading>& out);
+
+    /// the master's tap, written by the process thread
+    static LoudnessTap *master;
+    static unsigned int samprate;
+};
+
+#endif /* __LOUDNESS_H */
@@ -27,12 +27,25 @@
 #include "diamond.h"
 
 #include "process.h"
+#include "render.h"
+#include "arena.h"
+#include "loudness.h"
+#include "profile.h"
+#include "mixgraph.h"
+#include "workers.h"
+#include "denormals.h"
 
 using namespace std;
 
 // command line options
 struct option opts[]={
     {"nogui",no_argument,NULL,'n'},
+    {"render",required_argument,NULL,'r'},
+    {"output",required_argument,NULL,'o'},
+    {"period",required_argument,NULL,'p'},
+    {"threads",required_argument,NULL,'t'},
+    {"hugepages",no_argument,NULL,'H'},
+    {"denormal-check",no_argument,NULL,'D'},
     {NULL,0,NULL,0}
 };
 
@@ -50,11 +63,30 @@ void poll(){
 }
     
 
+static volatile sig_atomic_t noguiQuit=0;
+static void noguiSignal(int sig){
+    noguiQuit=1;
+}
+
 void noguiloop(){
-    while(1){
+    // stop cleanly, so that the load stats are printed
+    struct sigaction sa;
+    sa.sa_handler = noguiSignal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags=0;
+    sigaction(SIGINT,&sa,NULL);
+    sigaction(SIGTERM,&sa,NULL);
+    
+    while(!noguiQuit){
         usleep(100000);
         static MonitorData mdat;
-        Process::pollMonRing(&mdat);
+        // there's no monitor thread to pick up a new period size,
+        // free old graphs and so on
+        string err = Process::sendCmds();
+        if(err.size())
+            cerr << err << endl;
+        Process::pollMeters(&mdat);
+        Process::pollLoad();
         poll();
     }
 }
@@ -79,27 +111,58 @@ void guiloop(){
 
 void usage(){
     cerr << "usage:\n"
-          << "jackmix [-n] [configfile]\n";
+          << "jackmix [-n] [-t threads] [-H] [-D] [configfile]\n"
+          << "jackmix --render in1.wav,in2.wav.. -o out.wav [-p period] [-t threads] [-H] [-D] [configfile]\n"
+          << "(threads is the number of threads to run effect chains on, default one per CPU;\n"
+          << " -H puts the audio buffers in huge pages if it can;\n"
+          << " -D counts the subnormal numbers each effect outputs, best with\n"
+          << " 'denormals keep' in the config so that they aren't flushed)\n"
+          << "The process callback timings, xruns and DSP load are printed on exit,\n"
+          << "and to stderr on SIGUSR1.\n";
 }
 
 int main(int argc,char *argv[]){
     
     bool nogui=false;
-    
-    extern float *zeroBuf;
-    zeroBuf = new float[BUFSIZE];
-    for(int i=0;i<BUFSIZE;i++)zeroBuf[i]=0;
+    // offline rendering input list and output file
+    string renderInputs,renderOutput;
+    unsigned int renderPeriod=Render::DEFAULTPERIOD;
+    int threads=0;
     
     try {
         const char *filename="config";
         for(;;){
             int optind=0;
-            char c = getopt_long(argc,argv,"n",opts,&optind);
+            char c = getopt_long(argc,argv,"nr:o:p:t:HD",opts,&optind);
             if(c<0)break;
             switch(c){
             case 'n':
                 nogui=true;
                 break;
+            case 'r':
+                renderInputs=optarg;
+                break;
+            case 'o':
+                renderOutput=optarg;
+                break;
+            case 'p':{
+                int p=atoi(optarg);
+                if(p<1 || p>Render::MAXPERIOD)
+                    throw _("bad period size: %s",optarg);
+                renderPeriod=p;
+                break;
+            }
+            case 't':
+                threads=atoi(optarg);
+                if(threads<1)
+                    throw _("bad thread count: %s",optarg);
+                break;
+            case 'H':
+                Arena::hugePages=true;
+                break;
+            case 'D':
+                Denormals::check=true;
+                break;
             default:
                 usage();
                 throw _("incorrect usage");
@@ -107,12 +170,30 @@ int main(int argc,char *argv[]){
         }
         if(optind<argc)
             filename = argv[optind];
+        if(renderInputs.size() && !renderOutput.size()){
+            usage();
+            throw _("no output file given for render");
+        }
         // initialise data structures
         Process::init();
-        // initialise comms
-        diamond.init();
-        // initialise Jack
-        Process::initJack();
+        Profile::init();
+        if(renderInputs.size()){
+            // no jack or comms when rendering offline; the inputs
+            // set the sample rate instead.
+            Process::offline=true;
+            Process::setPeriod(renderPeriod);
+            Render::loadInputs(renderInputs);
+        } else {
+            // initialise comms
+            diamond.init();
+            // initialise Jack
+            Process::initJack();
+        }
+        // the loudness meters have their own thread, except offline
+        // where the renderer runs them after each period
+        Loudness::init(Process::samprate,!Process::offline);
+        // start the threads which run the effect chains
+        Workers::init(threads);
         
         // load LADSPA plugins
         PluginMgr::loadFilesIn("/usr/lib/ladspa",true);
@@ -122,6 +203,8 @@ int main(int argc,char *argv[]){
         parseConfig(filename);
         Ctrl::checkAllCtrlsForSource();
         Channel::resolveAllChannelChains();
+        // and build the first graph for the process thread
+        MixGraph::publish(MixGraph::build());
     } catch (const char *s){
         printf("Redundant error : %s\n",s);
         exit(1);
@@ -130,9 +213,26 @@ int main(int argc,char *argv[]){
         exit(1);
     }
     
+    if(Process::offline){
+        try {
+            Render::run(renderOutput,renderPeriod);
+        } catch (string s){
+            cout << "Fatal error: " << s << endl;
+            exit(1);
+        }
+        exit(0);
+    }
+    
     // start the processing thread
     Process::parsedAndReady=true;
     
+    // SIGUSR1 prints the load stats
+    struct sigaction sa;
+    sa.sa_handler = Process::requestLoadDump;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags=SA_RESTART;
+    sigaction(SIGUSR1,&sa,NULL);
+    
     try {
         if(nogui)
             noguiloop();
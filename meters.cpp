@@ -0,0 +1,21 @@
+/**
+ * @file meters.cpp
+ * @brief Time constants for the channel meters.
+ *
+ */
+
+#include "meters.h"
+
+// the time the RMS is averaged over, and the time a peak is held, in
+// seconds
+#define RMSTIME 0.3
+#define HOLDTIME 1.5
+
+float LevelMeter::msFrameDecay=0.99993f;
+int LevelMeter::holdFrames=72000;
+
+void LevelMeter::setRate(unsigned int samprate){
+    if(!samprate)return;
+    msFrameDecay = (float)exp(-1.0/(RMSTIME*samprate));
+    holdFrames = (int)(HOLDTIME*samprate);
+}
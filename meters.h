@@ -0,0 +1,181 @@
+/**
+ * @file meters.h
+ * @brief Channel meters, and the readings sent from the process thread
+ * to the display. The meters are fed the levels of each block from the
+ * mixing kernels. Each period the process thread writes a block of compact
+ * records, one per channel, into a triple-buffered mailbox; the display
+ * only ever wants the latest block, so it takes that and older ones are
+ * just overwritten. Names and everything else about the channels are
+ * looked up on the display side.
+ *
+ */
+
+#ifndef __METERS_H
+#define __METERS_H
+
+#include <atomic>
+#include <math.h>
+
+#include "kernels.h"
+
+/// the level of one side of a channel, measured a block at a time
+class LevelMeter {
+    float peak;
+    // mean square, averaged exponentially over RMSTIME
+    float ms;
+    // the highest recent peak, and how many more frames to hold it
+    float hold;
+    int holdLeft;
+    unsigned int clips;
+    // the decay over a block, for the last block length and rate
+    int lastn;
+    float lastFrameDecay;
+    float peakDecay,msDecay;
+
+    // per-frame decay of the mean square, and the frames a peak is
+    // held for, from the sample rate
+    static float msFrameDecay;
+    static int holdFrames;
+public:
+    LevelMeter(){
+        peak=ms=hold=0;
+        holdLeft=0;
+        clips=0;
+        lastn=0;
+        lastFrameDecay=0;
+        peakDecay=msDecay=0;
+    }
+
+    /// set up the time constants for a sample rate
+    static void setRate(unsigned int samprate);
+
+    /// feed the levels of a block of n frames, to which a gain has
+    /// been applied since they were measured (clips are counted
+    /// before it). The decay is done once for the block.
+    void in(const BlockLevels& b,float gain,int n){
+        if(n<=0)return;
+        if(n!=lastn || msFrameDecay!=lastFrameDecay){
+            lastn = n;
+            lastFrameDecay = msFrameDecay;
+            peakDecay = powf(0.99f,n);
+            msDecay = powf(msFrameDecay,n);
+        }
+        float p = b.peak*gain;
+        if(p>peak)
+            peak = p;
+        else
+            peak = p + (peak-p)*peakDecay;
+        float blockms = b.sumsq*gain*gain/n;
+        ms = blockms + (ms-blockms)*msDecay;
+        if(p>=hold){
+            hold = p;
+            holdLeft = holdFrames;
+        } else if((holdLeft-=n)<=0){
+            hold = peak;
+            holdLeft = 0;
+        }
+        clips += b.clips;
+    }
+
+    /// the current (decaying) peak
+    float get(){return peak;}
+    float getRMS(){return sqrtf(ms);}
+    float getHold(){return hold;}
+    /// samples at full scale since the start
+    unsigned int getClips(){return clips;}
+};
+
+/// the meter readings for a channel
+struct ChanMeter {
+    /// the channel's ID (see Channel::id); 0 is the master
+    unsigned int id;
+    // momentary peak values
+    float l,r;
+    float rmsl,rmsr;
+    float holdl,holdr;
+    unsigned int clipsl,clipsr;
+    // the gain and pan actually used, which may be partway through
+    // a ramp, so not the same as the values' targets.
+    float gain,pan;
+
+    /// fill in the levels from a channel's meters
+    void setLevels(LevelMeter& ml,LevelMeter& mr){
+        l = ml.get(); r = mr.get();
+        rmsl = ml.getRMS(); rmsr = mr.getRMS();
+        holdl = ml.getHold(); holdr = mr.getHold();
+        clipsl = ml.getClips(); clipsr = mr.getClips();
+    }
+};
+
+/// a period's readings
+struct MeterBlock {
+    /// generation of the graph this came from (see MixGraph)
+    unsigned int gen;
+    ChanMeter master;
+    /// mix paths this period, and how many were skipped (see MixGraph)
+    unsigned int paths,pathsSkipped;
+    unsigned int numchans;
+    ChanMeter *chans;
+};
+
+/// A mailbox holding the latest block of readings. There are three
+/// blocks: the one being written, the one being read, and the latest
+/// finished one, which the writer and reader swap theirs with.
+class MeterMailbox {
+    // set in the index of the middle block if it hasn't been read
+    static const int FRESH=4;
+
+    MeterBlock blocks[3];
+    ChanMeter *mem;
+    unsigned int cap;
+    // the middle block's index, with FRESH
+    std::atomic<int> middle;
+    // the writer's and the reader's blocks
+    int back,front;
+
+public:
+    /// make a mailbox which can hold up to n channels
+    MeterMailbox(unsigned int n) : middle(1){
+        cap = n;
+        mem = new ChanMeter[n*3];
+        for(int i=0;i<3;i++){
+            blocks[i].gen=0;
+            blocks[i].numchans=0;
+            blocks[i].paths=blocks[i].pathsSkipped=0;
+            blocks[i].chans = mem+n*i;
+        }
+        back=0;
+        front=2;
+    }
+
+    ~MeterMailbox(){
+        delete [] mem;
+    }
+
+    /// the most channels a block can hold
+    unsigned int capacity(){
+        return cap;
+    }
+
+    /// called from the process thread: the block to fill in
+    MeterBlock *getWriteBlock(){
+        return blocks+back;
+    }
+
+    /// called from the process thread once the block is filled in
+    void publish(){
+        back = middle.exchange(back|FRESH,std::memory_order_acq_rel)&~FRESH;
+    }
+
+    /// called from the display: the latest block, if there has been
+    /// one since the last call, or NULL. The block stays valid until
+    /// the next call.
+    MeterBlock *read(){
+        if(!(middle.load(std::memory_order_relaxed)&FRESH))
+            return NULL;
+        front = middle.exchange(front,std::memory_order_acq_rel)&~FRESH;
+        return blocks+front;
+    }
+};
+
+#endif /* __METERS_H */
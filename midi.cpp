@@ -5,45 +5,61 @@
  */
 
 #include <vector>
-#include <unordered_map>
+#include <sstream>
+#include <atomic>
+#include <stdlib.h>
 #include "ctrl.h"
 #include "midi.h"
+#include "ringbuffer.h"
 #include "stringsplit.h"
 
 using namespace std;
 
 MidiSource midi;
 
-// this is a map of midi cc to a list of controllers which are
-// fed by that cc.
+// this is a table of midi channel and cc to a list of controllers
+// which are fed by that cc. It is only changed outside the process
+// thread, which gets a copy in each MixGraph.
 
-static unordered_map<int,vector<Ctrl *>> sources;
+static vector<Ctrl *> sources[MIDICHANS*MIDICCS];
 
 // if we are waiting for some cc input to determine which midi cc
-// is to control a ctrl, then this is the ctrl that's waiting.
+// is to control a ctrl, then this is the ctrl that's waiting. The
+// process thread just passes ccs back through the learn ring while
+// it's waiting, and pollLearn() does the rest.
 
 static Ctrl *waitingForInput = NULL;
 static int recordedInput = -1;
-inline int getidx(int chan,int cc){
-    return chan*128+cc;
-}
+static std::atomic<bool> learning(false);
+
+struct MidiLearnData {
+    unsigned char chan,cc,val;
+};
+static RingBuffer<MidiLearnData> learnring(64);
 
 const char* MidiSource::add(string source, Ctrl *c){
     if(source == "input"){
         if(waitingForInput) return "Already waiting.";
         c->sourceInfo = new MidiSourceInfo(-1,-1);
         waitingForInput = c;
+        recordedInput = -1;
         c->source = this;
+        // anything still in the ring is from before we started
+        MidiLearnData d;
+        while(learnring.read(d)){}
+        learning.store(true);
         return NULL;
     } else {
         vector<string> v = split(source,':');
         if(v.size()!=2){
             return "Failed : vector size wrong";
         }
-        
+
         int chan = atoi(v[0].c_str());
         int cc = atoi(v[1].c_str());
-        if(cc>=0 && cc<127){
+        if(chan<1 || chan>MIDICHANS)
+            return "Failed : channel out of range";
+        if(cc>=0 && cc<MIDICCS){
             sources[getidx(chan,cc)].push_back(c);
             c->sourceInfo = new MidiSourceInfo(chan,cc);
             c->source = this;
@@ -55,32 +71,63 @@ const char* MidiSource::add(string source, Ctrl *c){
 
 void MidiSource::remove(Ctrl *c){
     MidiSourceInfo *info = (MidiSourceInfo*)(c->sourceInfo);
-    vector<Ctrl *>& v = sources[getidx(info->chan,info->cc)];
-    v.erase(std::remove(v.begin(),v.end(),c),v.end());
+    if(c == waitingForInput){
+        waitingForInput = NULL;
+        learning.store(false);
+    } else {
+        vector<Ctrl *>& v = sources[getidx(info->chan,info->cc)];
+        v.erase(std::remove(v.begin(),v.end(),c),v.end());
+    }
     delete info;
 }
 
-void MidiSource::feed(int chan, int cc,float val){
-    if(waitingForInput){
+void MidiSource::compile(MidiMap& m){
+    m.ctrls.clear();
+    for(int i=0;i<MIDICHANS*MIDICCS;i++){
+        m.first[i] = m.ctrls.size();
+        m.ctrls.insert(m.ctrls.end(),sources[i].begin(),sources[i].end());
+    }
+    m.first[MIDICHANS*MIDICCS] = m.ctrls.size();
+}
+
+void MidiSource::feed(const MidiMap& m,int chan, int cc,int val){
+    if(chan<1 || chan>MIDICHANS || cc<0 || cc>=MIDICCS)
+        return;
+
+    // if the ring is full the data is dropped, but there'll be more
+    if(learning.load(std::memory_order_relaxed) && learnring.canWrite()){
+        MidiLearnData d = {(unsigned char)chan,(unsigned char)cc,
+            (unsigned char)val};
+        learnring.write(d);
+    }
+
+    int idx = getidx(chan,cc);
+    for(unsigned int i=m.first[idx];i<m.first[idx+1];i++){
+        m.ctrls[i]->setval(val);
+    }
+}
+
+bool MidiSource::pollLearn(){
+    MidiLearnData d;
+    while(learnring.read(d)){
+        if(!waitingForInput)
+            continue;
         if(recordedInput<0)
-            recordedInput = val;
-        
-        if(abs(recordedInput-val)>20){
+            recordedInput = d.val;
+
+        if(abs(recordedInput-d.val)>20){
             MidiSourceInfo *info = (MidiSourceInfo*)(waitingForInput->sourceInfo);
-            info->chan = chan;
-            info->cc = cc;
+            info->chan = d.chan;
+            info->cc = d.cc;
             stringstream ss;
-            ss << chan << ":" << cc;
+            ss << (int)d.chan << ":" << (int)d.cc;
             waitingForInput->sourceString = ss.str();
-            sources[getidx(chan,cc)].push_back(waitingForInput);
+            sources[getidx(d.chan,d.cc)].push_back(waitingForInput);
             waitingForInput = NULL;
             recordedInput = -1;
+            learning.store(false);
+            return true;
         }
     }
-    
-    vector<Ctrl *>::iterator it;
-    int idx = getidx(chan,cc);
-    for(it=sources[idx].begin();it!=sources[idx].end();it++){
-        (*it)->setval(val);
-    }
+    return false;
 }
@@ -7,8 +7,21 @@
 #ifndef __MIDI_H
 #define __MIDI_H
 
+#include <vector>
+#include "ctrl.h"
 #include "ctrlsource.h"
 
+#define MIDICHANS 16
+#define MIDICCS 128
+
+/// the controllers fed by each midi channel and cc, flattened into
+/// a fixed table for the process thread: those for index i (see
+/// MidiSource::getidx()) are ctrls[first[i]] up to ctrls[first[i+1]].
+struct MidiMap {
+    unsigned int first[MIDICHANS*MIDICCS+1];
+    std::vector<Ctrl *> ctrls;
+};
+
 class MidiSource : public CtrlSource {
 public:
     virtual const char * add(std::string source,Ctrl *c);
@@ -17,8 +30,23 @@ public:
         c->setinrange(0,127);
     }
     virtual const char *getName(){ return "midi"; }
-    
-    void feed(int chan, int cc,float val);
+
+    /// index into the table for a channel (1-16) and cc
+    static int getidx(int chan,int cc){
+        return (chan-1)*MIDICCS+cc;
+    }
+
+    /// build the process thread's table from the current mappings
+    void compile(MidiMap& m);
+
+    /// called from the process thread with a cc, to pass it on
+    /// to the controllers in the table.
+    void feed(const MidiMap& m,int chan,int cc,int val);
+
+    /// called outside the process thread to see if a controller
+    /// waiting for input has got it. If so, the mappings have changed
+    /// and true is returned.
+    bool pollLearn();
 };
 
 struct MidiSourceInfo : public CtrlSourceInfo {
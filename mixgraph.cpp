@@ -0,0 +1,594 @@
+/**
+ * @file mixgraph.cpp
+ * @brief Building, swapping and running mix graph snapshots.
+ *
+ */
+
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include "mixgraph.h"
+#include "channel.h"
+#include "fx.h"
+#include "ctrl.h"
+#include "kernels.h"
+#include "meters.h"
+#include "workers.h"
+#include "exception.h"
+#include "process.h"
+#include "arena.h"
+#include "loudness.h"
+#include "profile.h"
+#include "denormals.h"
+
+using namespace std;
+
+std::atomic<MixGraph *> MixGraph::pending(NULL);
+MixGraph *MixGraph::current=NULL;
+MixGraph *MixGraph::retiring=NULL;
+RingBuffer<MixGraph *> MixGraph::retired(16);
+unsigned int MixGraph::nextGen=1;
+unsigned int MixGraph::liveGen=0;
+MeterMailbox *MixGraph::meterbox=NULL;
+Graveyard MixGraph::graveyard;
+
+template <class T> static void append(vector<T>& to,vector<T>& from){
+    to.insert(to.end(),from.begin(),from.end());
+    from.clear();
+}
+
+void Graveyard::take(Graveyard& g){
+    append(chans,g.chans);
+    append(chains,g.chains);
+    append(fx,g.fx);
+    append(conns,g.conns);
+    append(values,g.values);
+    append(ctrls,g.ctrls);
+    append(meters,g.meters);
+    append(taps,g.taps);
+}
+
+void Graveyard::free(){
+    // ctrls first, as they clear the ctrl pointers of their values
+    for(unsigned int i=0;i<ctrls.size();i++)
+        delete ctrls[i];
+    for(unsigned int i=0;i<chans.size();i++)
+        delete chans[i];
+    // deleting a chain deletes its effects
+    for(unsigned int i=0;i<chains.size();i++)
+        delete chains[i];
+    for(unsigned int i=0;i<fx.size();i++)
+        delete fx[i];
+    for(unsigned int i=0;i<conns.size();i++)
+        delete conns[i];
+    for(unsigned int i=0;i<values.size();i++)
+        delete values[i];
+    for(unsigned int i=0;i<meters.size();i++)
+        delete meters[i];
+    for(unsigned int i=0;i<taps.size();i++)
+        delete taps[i];
+    chans.clear();
+    chains.clear();
+    fx.clear();
+    conns.clear();
+    values.clear();
+    ctrls.clear();
+    meters.clear();
+    taps.clear();
+}
+
+/*
+ * UI side
+ */
+
+MixGraph::MixGraph(){
+    arena=NULL;
+    paths=pathsSkipped=0;
+}
+
+MixGraph::~MixGraph(){
+    delete arena;
+}
+
+void MixGraph::addBuffer(BufferId id,int level){
+    unordered_map<BufferId,BufInfo>::iterator it = bufmap.find(id);
+    if(it==bufmap.end()){
+        BufInfo b = {level,0};
+        bufmap[id]=b;
+    } else if(it->second.level!=level)
+        it->second.level=-1; // used at more than one level
+}
+
+void MixGraph::layoutBuffers(){
+    size_t len = Arena::round(bufsize);
+    
+    // buffers which last the whole block come first, then those of
+    // each level, with every level starting at the same place.
+    size_t fixed = 2*len; // the mix buffers
+    unordered_map<BufferId,BufInfo>::iterator it;
+    for(it=bufmap.begin();it!=bufmap.end();it++){
+        if(it->second.level<0){
+            it->second.offset = fixed;
+            fixed+=len;
+        }
+    }
+    vector<size_t> used;
+    for(it=bufmap.begin();it!=bufmap.end();it++){
+        int l = it->second.level;
+        if(l<0)continue;
+        if((int)used.size()<=l)
+            used.resize(l+1,0);
+        it->second.offset = fixed+used[l];
+        used[l]+=len;
+    }
+    size_t most=0;
+    for(unsigned int i=0;i<used.size();i++)
+        if(used[i]>most)most=used[i];
+    
+    arena = new Arena(fixed+most);
+    mixl = arena->get();
+    mixr = arena->get()+len;
+    
+    for(it=bufmap.begin();it!=bufmap.end();it++){
+        if(it->second.level<0){
+            Persist p = {it->first,arena->get()+it->second.offset};
+            persist.push_back(p);
+        }
+    }
+    sort(persist.begin(),persist.end(),
+         [](const Persist& a,const Persist& b){return a.id<b.id;});
+}
+
+void MixGraph::carryBuffers(const MixGraph *old){
+    size_t bytes = min(bufsize,old->bufsize)*sizeof(float);
+    // both lists are sorted by ID
+    unsigned int j=0;
+    for(unsigned int i=0;i<persist.size();i++){
+        while(j<old->persist.size() && old->persist[j].id<persist[i].id)
+            j++;
+        if(j==old->persist.size())
+            break;
+        if(old->persist[j].id==persist[i].id)
+            memcpy(persist[i].buf,old->persist[j].buf,bytes);
+    }
+}
+
+float *MixGraph::buf(BufferId id){
+    unordered_map<BufferId,BufInfo>::iterator it = bufmap.find(id);
+    if(it==bufmap.end())
+        throw _("audio buffer is not in the mix graph");
+    return arena->get()+it->second.offset;
+}
+
+void MixGraph::addChans(vector<Chan>& out,const vector<Channel *>& in){
+    for(unsigned int i=0;i<in.size();i++){
+        Channel *ch = in[i];
+        Chan c;
+        c.chan = ch;
+        c.gain = ch->gain;
+        c.pan = ch->pan;
+        c.mono = ch->mono;
+        c.tap = ch->tap;
+        if(ch->isret && ch->returnChain){
+            c.retl = buf(ch->returnChain->leftoutbuf);
+            c.retr = buf(ch->returnChain->rightoutbuf);
+        } else
+            c.retl = c.retr = NULL;
+        c.firstSend = sends.size();
+        c.numSends = ch->chains.size();
+        for(unsigned int j=0;j<ch->chains.size();j++){
+            ChainFeed& f = ch->chains[j];
+            Send s = {f.gain,buf(f.chain->inpleft),buf(f.chain->inpright),
+                f.postfade};
+            sends.push_back(s);
+        }
+        out.push_back(c);
+    }
+}
+
+vector<int> MixGraph::levelChains(){
+    unsigned int n = chainlist.size();
+    unordered_map<ChainInterface *,int> idx;
+    for(unsigned int i=0;i<n;i++)
+        idx[chainlist[i]]=i;
+
+    // a chain feeds another if one of its return channels sends to it
+    vector<vector<int>> feeds(n);
+    vector<int> inputs(n,0);
+    for(unsigned int i=0;i<Channel::returnchans.size();i++){
+        Channel *r = Channel::returnchans[i];
+        if(!r->returnChain || !idx.count(r->returnChain))
+            continue;
+        int from = idx[r->returnChain];
+        for(unsigned int j=0;j<r->chains.size();j++){
+            int to = idx[r->chains[j].chain];
+            feeds[from].push_back(to);
+            inputs[to]++;
+        }
+    }
+
+    // take chains off in the order they become ready, each a level
+    // after the latest chain feeding it.
+    vector<int> level(n,0);
+    vector<int> ready;
+    for(unsigned int i=0;i<n;i++)
+        if(!inputs[i])ready.push_back(i);
+    unsigned int done=0;
+    while(ready.size()){
+        int c = ready.back();
+        ready.pop_back();
+        done++;
+        for(unsigned int j=0;j<feeds[c].size();j++){
+            int to = feeds[c][j];
+            if(level[to]<level[c]+1)
+                level[to]=level[c]+1;
+            if(!--inputs[to])
+                ready.push_back(to);
+        }
+    }
+    if(done<n)
+        throw _("effect chains would feed each other in a loop");
+    return level;
+}
+
+MixGraph *MixGraph::build(){
+    MixGraph *g = new MixGraph();
+    g->gen = nextGen++;
+    g->bufsize = Process::bufsize;
+    g->cmdseq = 0;
+    g->replacedBy = NULL;
+
+    vector<int> level = levelChains();
+    int numLevels=0;
+    for(unsigned int i=0;i<level.size();i++)
+        if(level[i]>=numLevels)numLevels=level[i]+1;
+    
+    // give the buffers of the model memory in the graph's arena
+    extern BufferId zeroBuf;
+    g->addBuffer(zeroBuf,-1);
+    for(unsigned int i=0;i<chainlist.size();i++)
+        chainlist[i]->addBuffers(g,level[i]);
+    g->layoutBuffers();
+
+    // compile the chains a level at a time, each level followed by
+    // the returns of its chains. Returns without a chain go last.
+    for(int l=0;l<=numLevels;l++){
+        Level lev;
+        lev.firstBranch = g->branches.size();
+        lev.firstReturn = g->returnOrder.size();
+        lev.firstChain = g->chainRuns.size();
+        for(unsigned int i=0;i<chainlist.size();i++){
+            if(level[i]!=l)continue;
+            chainlist[i]->compile(g);
+            for(unsigned int j=0;j<Channel::returnchans.size();j++)
+                if(Channel::returnchans[j]->returnChain==chainlist[i])
+                    g->returnOrder.push_back(j);
+        }
+        if(l==numLevels){
+            for(unsigned int j=0;j<Channel::returnchans.size();j++)
+                if(!Channel::returnchans[j]->returnChain)
+                    g->returnOrder.push_back(j);
+        }
+        lev.numBranches = g->branches.size()-lev.firstBranch;
+        lev.numReturns = g->returnOrder.size()-lev.firstReturn;
+        lev.numChains = g->chainRuns.size()-lev.firstChain;
+        if(lev.numBranches || lev.numReturns)
+            g->levels.push_back(lev);
+    }
+    g->addChans(g->inputs,Channel::inputchans);
+    g->addChans(g->returns,Channel::returnchans);
+    
+    // make a bigger meter mailbox if there are too many channels,
+    // with room for more
+    unsigned int nchans = g->inputs.size()+g->returns.size();
+    if(!meterbox || meterbox->capacity()<nchans){
+        if(meterbox)
+            graveyard.meters.push_back(meterbox);
+        meterbox = new MeterMailbox(nchans<32 ? 64 : nchans*2);
+    }
+    g->meters = meterbox;
+
+    midi.compile(g->midimap);
+
+    g->values = Value::values;
+    g->activeValues.resize(g->values.size()+1);
+    g->detach.swap(Value::detached);
+    g->dead.take(graveyard);
+    return g;
+}
+
+void MixGraph::publish(MixGraph *g){
+    MixGraph *old = pending.exchange(g);
+    if(old){
+        // never picked up, so the process thread never saw it, but
+        // what it was keeping alive now has to wait for this one.
+        g->dead.take(old->dead);
+        append(g->detach,old->detach);
+        delete old;
+    }
+}
+
+bool MixGraph::collect(){
+    bool rv=false;
+    MixGraph *old;
+    while(retired.getReadSpace()){
+        retired.read(old);
+        MixGraph *g = old->replacedBy;
+        liveGen = g->gen;
+        // the first graph can have things in its graveyard too
+        old->dead.free();
+        g->dead.free();
+        delete old;
+        rv=true;
+    }
+    return rv;
+}
+
+/*
+ * Process thread side
+ */
+
+MixGraph *MixGraph::acquire(){
+    // only one replaced graph waits to be passed back at a time
+    if(!retiring && pending.load(std::memory_order_relaxed)){
+        MixGraph *g = pending.exchange(NULL);
+        if(g){
+            for(unsigned int i=0;i<g->detach.size();i++)
+                Ctrl::removeAllAssociations(g->detach[i]);
+            for(unsigned int i=0;i<g->conns.size();i++){
+                Conn& c = g->conns[i];
+                (*c.connect)(c.h,c.port,c.buf);
+            }
+            Value::startActive(g->values,&g->activeValues[0],
+                               g->activeValues.size());
+            if(current)
+                g->carryBuffers(current);
+            retiring = current;
+            current = g;
+        }
+    }
+    return current;
+}
+
+void MixGraph::release(){
+    // if the ring is full, try again next period
+    if(retiring && retired.canWrite()){
+        retiring->replacedBy = current;
+        retired.write(retiring);
+        retiring = NULL;
+    }
+}
+
+void MixGraph::cacheInputBuffers(int nframes){
+    for(unsigned int i=0;i<inputs.size();i++)
+        inputs[i].chan->cachebufs(nframes);
+}
+
+void MixGraph::pollCtrls(){
+    Ctrl::pollDirty();
+}
+
+void MixGraph::updateValues(int start,int nframes,unsigned int samprate){
+    Value::rampStart = start;
+    Value::period = nframes;
+    Value::updateActive(nframes,samprate);
+}
+
+void MixGraph::zeroChainInputs(int nframes){
+    for(unsigned int i=0;i<chainInputs.size();i++)
+        memset(chainInputs[i],0,nframes*sizeof(float));
+}
+
+void MixGraph::mixInputs(float *__restrict leftout,
+                         float *__restrict rightout,
+                         int offset,int nframes){
+    memset(leftout,0,nframes*sizeof(float));
+    memset(rightout,0,nframes*sizeof(float));
+    for(unsigned int i=0;i<inputs.size();i++)
+        mixChan(inputs[i],leftout,rightout,offset,nframes);
+}
+
+void MixGraph::runBranch(void *ctx,int i){
+    MixGraph *g = (MixGraph *)ctx;
+    Branch& c = g->branches[g->fxLevel->firstBranch+i];
+    if(c.suspended)
+        return;
+    uint64_t start = Profile::now();
+    uint64_t t = start;
+    for(int j=c.firstFx;j<c.firstFx+c.numFx;j++){
+        Fx& f = g->fx[j];
+        (*f.run)(f.h,g->fxFrames);
+        uint64_t t1 = Profile::now();
+        f.prof->record(t1-t);
+        if(Denormals::check.load(std::memory_order_relaxed)){
+            unsigned int n=0;
+            for(int k=f.firstOut;k<f.firstOut+f.numOuts;k++)
+                n+=Kernels::subnormals(g->fxOutputs[k],g->fxFrames);
+            f.prof->addDenormals(n);
+            // don't count the check as the effect's time
+            t1 = Profile::now();
+        }
+        t = t1;
+    }
+    c.prof->add(t-start);
+}
+
+void MixGraph::runChains(float *__restrict leftout,
+                         float *__restrict rightout,
+                         int offset,int nframes){
+    fxFrames = nframes;
+    uint64_t tchains=0,treturns=0;
+    uint64_t t0 = Profile::now();
+    for(unsigned int i=0;i<levels.size();i++){
+        Level& l = levels[i];
+        fxLevel = &l;
+        suspendChains(l,nframes);
+        Workers::run(l.numBranches,runBranch,this);
+        checkQuietChains(l,nframes);
+        // all the level's branches are done, so record their chains
+        for(int j=l.firstBranch;j<l.firstBranch+l.numBranches;j++)
+            branches[j].prof->flush();
+        uint64_t t1 = Profile::now();
+        for(int j=l.firstReturn;j<l.firstReturn+l.numReturns;j++)
+            mixChan(returns[returnOrder[j]],leftout,rightout,offset,nframes);
+        uint64_t t2 = Profile::now();
+        tchains += t1-t0;
+        treturns += t2-t1;
+        t0 = t2;
+    }
+    Profile::phases[ProfChains]->record(tchains);
+    Profile::phases[ProfReturns]->record(treturns);
+}
+
+void MixGraph::suspendChains(Level& l,int nframes){
+    for(int i=l.firstChain;i<l.firstChain+l.numChains;i++){
+        ChainRun& r = chainRuns[i];
+        if(!r.holdFrames)
+            continue;
+        ChainInterface *c = r.chain;
+        r.quietIn = Kernels::silent(r.inl,nframes) &&
+              Kernels::silent(r.inr,nframes);
+        bool susp = c->suspended.load(std::memory_order_relaxed);
+        if(!r.quietIn){
+            // input is back, so wake up
+            c->quietFrames=0;
+            if(susp){
+                susp=false;
+                c->suspended.store(false,std::memory_order_relaxed);
+            }
+        }
+        for(int j=r.firstBranch;j<r.firstBranch+r.numBranches;j++)
+            branches[j].suspended = susp;
+        // the output buffers may hold anything, so fill them with the
+        // silence the effects would have made
+        if(susp){
+            memset(r.outl,0,nframes*sizeof(float));
+            memset(r.outr,0,nframes*sizeof(float));
+        }
+    }
+}
+
+void MixGraph::checkQuietChains(Level& l,int nframes){
+    for(int i=l.firstChain;i<l.firstChain+l.numChains;i++){
+        ChainRun& r = chainRuns[i];
+        ChainInterface *c = r.chain;
+        if(!r.holdFrames || !r.quietIn ||
+           c->suspended.load(std::memory_order_relaxed))
+            continue;
+        if(Kernels::below(r.outl,nframes,r.level) &&
+           Kernels::below(r.outr,nframes,r.level)){
+            c->quietFrames += nframes;
+            if(c->quietFrames>=r.holdFrames)
+                c->suspended.store(true,std::memory_order_relaxed);
+        } else
+            c->quietFrames=0;
+    }
+}
+
+void MixGraph::mixChan(Chan& c,float *__restrict leftout,
+                       float *__restrict rightout,int offset,int nframes){
+    Channel *ch = c.chan;
+    float *left = c.retl ? c.retl : ch->left;
+    float *right = c.retl ? c.retr : ch->right;
+
+    // skip any channels without the required buffers
+    if(!left || (!c.mono && !right))
+        return;
+
+    // input channels use the period's port buffers, but chain outputs
+    // only hold the current block.
+    int inoff = c.retl ? 0 : offset;
+    float *inl = left+inoff;
+    float *inr = c.mono ? inl : right+inoff;
+
+    // the gains at the start and end of the ramp; the kernel ramps
+    // between them.
+    float gl0,gr0,gl,gr;
+    pangains(c.mono,c.pan->getStart(),c.gain->getStart(),&gl0,&gr0);
+    pangains(c.mono,c.pan->get(),c.gain->get(),&gl,&gr);
+    int period = Value::period;
+    int pos = offset-Value::rampStart;
+
+    // digital silence doesn't need mixing anywhere, and nor does
+    // anything through a gain at the bottom of its range; the meters
+    // are still fed, so that they decay.
+    bool quiet = Kernels::silent(inl,nframes) &&
+          (c.mono || Kernels::silent(inr,nframes));
+    bool faderOff = c.gain->isOff();
+    int skipped=0;
+
+    // build the list of places this channel goes, so that the kernel
+    // can do them all in one pass: the master outputs if it is not muted,
+    // and there is not a solo channel (which isn't us), and the chains.
+    MixDest dests[MAXMIXDESTS];
+    int nd=0;
+    if(quiet || faderOff || ch->mute ||
+       (Channel::solochan && (ch!=Channel::solochan))){
+        skipped++;
+    } else {
+        dests[nd].l = leftout;
+        dests[nd].r = rightout;
+        dests[nd].setRamp(gl0,gr0,gl,gr,pos,period);
+        nd++;
+    }
+
+    BlockLevels lvl,lvr;
+    bool mixed=false;
+    Send *s = sends.data()+c.firstSend;
+    for(int i=0;i<c.numSends;i++,s++){
+        if(quiet || s->gain->isOff() || (s->postfade && faderOff)){
+            skipped++;
+            continue;
+        }
+        float g0 = s->gain->getStart();
+        float g = s->gain->get();
+        MixDest& d = dests[nd++];
+        d.l = s->l;
+        d.r = s->r;
+        if(s->postfade){
+            // mono post-fade sends get the panned left channel on
+            // both sides.
+            d.setRamp(gl0*g0,(c.mono ? gl0 : gr0)*g0,
+                      gl*g,(c.mono ? gl : gr)*g,pos,period);
+        } else {
+            d.setRamp(g0,g0,g,g,pos,period);
+        }
+        if(nd==MAXMIXDESTS){
+            Kernels::mix(inl,inr,nframes,dests,nd,&lvl,&lvr);
+            nd=0;
+            mixed=true;
+        }
+    }
+    if(quiet){
+        lvl.peak=lvl.sumsq=0;
+        lvl.clips=0;
+        lvr=lvl;
+    } else if(nd || !mixed)
+        Kernels::mix(inl,inr,nframes,dests,nd,&lvl,&lvr);
+    paths += 1+c.numSends;
+    pathsSkipped += skipped;
+
+    // monitoring, using the larger gain of the ramp
+    ch->monl.in(lvl,fmaxf(fabsf(gl0),fabsf(gl)),nframes);
+    ch->monr.in(lvr,fmaxf(fabsf(gr0),fabsf(gr)),nframes);
+    // and the loudness meter gets the post-fader signal
+    if(c.tap)
+        c.tap->write(inl,inr,nframes,gl0,gr0,gl,gr,pos,period);
+}
+
+void MixGraph::writeMeters(MeterBlock *m){
+    m->gen = gen;
+    m->paths = paths;
+    m->pathsSkipped = pathsSkipped;
+    m->numchans = inputs.size()+returns.size();
+    for(unsigned int i=0;i<m->numchans;i++){
+        Chan& c = i<inputs.size() ? inputs[i] : returns[i-inputs.size()];
+        Channel *ch = c.chan;
+        ChanMeter& cm = m->chans[i];
+        cm.id = ch->id;
+        cm.setLevels(ch->monl,ch->monr);
+        cm.gain = c.gain->getNoDBConvert();
+        cm.pan = c.pan->get();
+    }
+}
@@ -0,0 +1,311 @@
+/**
+ * @file mixgraph.h
+ * @brief A compiled snapshot of the mix graph, which is what the
+ * process thread actually runs. The channels, chains and effects
+ * are an editable model owned by the UI; whenever that changes, a
+ * new snapshot is built from it in flat arrays and handed to the
+ * process thread, which swaps it in at the start of a period.
+ *
+ */
+
+#ifndef __MIXGRAPH_H
+#define __MIXGRAPH_H
+
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+
+#include "ladspa.h"
+#include "ringbuffer.h"
+#include "midi.h"
+#include "arena.h"
+
+class Channel;
+class Value;
+class Ctrl;
+class PluginInstance;
+struct ChainInterface;
+struct InputConnectionData;
+struct MeterBlock;
+class MeterMailbox;
+class LoudnessTap;
+class ProfStats;
+
+// things taken out of the model. They can only be deleted once no
+// graph the process thread might still be running refers to them.
+
+struct Graveyard {
+    std::vector<Channel *> chans;
+    std::vector<ChainInterface *> chains;
+    std::vector<PluginInstance *> fx;
+    std::vector<std::vector<InputConnectionData> *> conns;
+    std::vector<Value *> values;
+    std::vector<Ctrl *> ctrls;
+    std::vector<MeterMailbox *> meters;
+    std::vector<LoudnessTap *> taps;
+
+    // move everything from another graveyard into this one
+    void take(Graveyard& g);
+    // delete everything
+    void free();
+};
+
+struct MixGraph {
+    // a channel and everything needed to mix it
+    struct Chan {
+        Channel *chan;
+        Value *gain,*pan;
+        // the chain outputs for a return channel, NULL for an input
+        // channel (which uses the channel's cached port buffers).
+        float *retl,*retr;
+        bool mono;
+        // the channel's loudness meter, or NULL
+        LoudnessTap *tap;
+        // this channel's sends in the send table
+        int firstSend,numSends;
+    };
+
+    // a send into a chain's inputs
+    struct Send {
+        Value *gain;
+        float *l,*r;
+        bool postfade;
+    };
+
+    // an effect to run, in order
+    struct Fx {
+        LADSPA_Handle h;
+        void (*run)(LADSPA_Handle,unsigned long);
+        ProfStats *prof;
+        // its output buffers in fxOutputs, for the denormal check
+        int firstOut,numOuts;
+    };
+
+    // a branch of a chain: effects which are connected to each other,
+    // run in order. A chain's branches are independent of each other.
+    struct Branch {
+        int firstFx,numFx;
+        // the chain's profiling counters
+        ProfStats *prof;
+        // set by the process thread while the chain is suspended
+        bool suspended;
+    };
+
+    // what a chain needs to decide whether to suspend itself (see
+    // ChainInterface::suspendDb)
+    struct ChainRun {
+        ChainInterface *chain;
+        float *inl,*inr,*outl,*outr;
+        // the output level under which it counts as quiet, and how
+        // long for, 0 if it never suspends
+        float level;
+        unsigned int holdFrames;
+        // its branches
+        int firstBranch,numBranches;
+        // whether its input was silent this block
+        bool quietIn;
+    };
+
+    // the branches of a set of chains which don't feed each other, and
+    // their return channels (as indices into returnOrder). A level's
+    // chains only get input from input channels and from the returns
+    // of earlier levels.
+    struct Level {
+        int firstBranch,numBranches;
+        int firstReturn,numReturns;
+        // the level's chains in chainRuns
+        int firstChain,numChains;
+    };
+
+    // an audio input connection, made when the graph is adopted
+    struct Conn {
+        LADSPA_Handle h;
+        void (*connect)(LADSPA_Handle,unsigned long,LADSPA_Data *);
+        unsigned long port;
+        float *buf;
+    };
+
+    std::vector<Chan> inputs,returns;
+    std::vector<Send> sends;
+    // left and right input buffers of every chain, zeroed each block
+    std::vector<float *> chainInputs;
+    std::vector<Fx> fx;
+    std::vector<float *> fxOutputs;
+    // the chains' branches, in level order
+    std::vector<Branch> branches;
+    // the chains, in level order
+    std::vector<ChainRun> chainRuns;
+    std::vector<Level> levels;
+    // indices of the return channels in level order; returns is in
+    // the model's order, which monitoring uses.
+    std::vector<int> returnOrder;
+    std::vector<Conn> conns;
+    // the values in the model, and room for the ones which are moving
+    // (see Value::activeSet)
+    std::vector<Value *> values;
+    std::vector<Value *> activeValues;
+    // which controllers each midi cc goes to
+    MidiMap midimap;
+    // values removed from the model while attached to a controller;
+    // the process thread detaches them when it adopts this graph.
+    std::vector<Value *> detach;
+    // objects which were removed from the model before this graph
+    // was built, freed once it has replaced the previous graph.
+    Graveyard dead;
+
+    // the size of the chain and effect buffers, so the most frames
+    // which can be processed at once
+    unsigned int bufsize;
+    // the memory for all this graph's audio buffers
+    Arena *arena;
+    // the stereo mix of everything, before the master gain
+    float *mixl,*mixr;
+    // where the meter readings go
+    MeterMailbox *meters;
+    // generation number, increasing with each build
+    unsigned int gen;
+    // sequence number of the last command applied to the model
+    // before this was built (see Process::writeCmd())
+    unsigned int cmdseq;
+    // set by the process thread when this graph is replaced
+    MixGraph *replacedBy;
+
+    /*
+     * UI side
+     */
+
+    MixGraph();
+    ~MixGraph();
+
+    /// build a graph from the model as it is now
+    static MixGraph *build();
+
+    /// while building, add a buffer of the model (see Arena) which is
+    /// used by chains at the given level, or -1 if its contents have
+    /// to last from one block to the next. Buffers only used at
+    /// different levels can share memory.
+    void addBuffer(BufferId id,int level);
+
+    /// while building, after layoutBuffers(): this graph's memory for
+    /// a buffer of the model.
+    float *buf(BufferId id);
+
+    /// work out which level each chain in chainlist runs at, so that
+    /// a chain runs after any chain whose return channel sends to it.
+    /// Throws if the chains feed each other in a loop.
+    static std::vector<int> levelChains();
+
+    /// hand a graph to the process thread, replacing any it
+    /// hasn't picked up yet.
+    static void publish(MixGraph *g);
+    
+    /// true if a published graph hasn't been picked up yet
+    static bool isPending(){
+        return pending.load()!=NULL;
+    }
+
+    /// free any graphs the process thread has finished with, and
+    /// anything they were keeping alive. Returns true if any were
+    /// freed, in which case see getLiveGen().
+    static bool collect();
+
+    /// add objects removed from the model, to be deleted when it
+    /// is safe. They go into the next graph published.
+    static Graveyard graveyard;
+
+    /// the mailbox the latest graph sends meter readings to. It is
+    /// replaced when there are more channels than it can hold, so
+    /// after a change there may be no readings until the process
+    /// thread picks up the new graph.
+    static MeterMailbox *getMeters(){
+        return meterbox;
+    }
+
+    /// the generation of the oldest graph the process thread might
+    /// be running. Anything from an older graph (such as channel
+    /// pointers in monitoring data) may refer to deleted objects.
+    static unsigned int getLiveGen(){
+        return liveGen;
+    }
+
+    /*
+     * process thread side
+     */
+
+    /// at the start of a period, pick up any new graph and return
+    /// the current one.
+    static MixGraph *acquire();
+
+    /// at the end of a period, pass back the graph replaced by
+    /// acquire(), if any.
+    static void release();
+
+    /// cache the jack port buffers of the input channels
+    void cacheInputBuffers(int nframes);
+    /// pass on new settings from the controllers which have changed
+    /// to their values
+    void pollCtrls();
+    /// update the moving values at the start of a ramp of nframes
+    /// starting at the given frame in the period
+    void updateValues(int start,int nframes,unsigned int samprate);
+    /// clear the chain inputs
+    void zeroChainInputs(int nframes);
+    /// mix the input channels into the output buffers, which are
+    /// cleared first, and into the chain inputs.
+    void mixInputs(float *leftout,float *rightout,int offset,int nframes);
+    /// run the chains a level at a time, running the branches in
+    /// parallel if there are worker threads, and mixing each level's
+    /// return channels into the output buffers and into the inputs
+    /// of later chains.
+    void runChains(float *leftout,float *rightout,int offset,int nframes);
+    /// fill in the channel meter readings
+    void writeMeters(MeterBlock *m);
+
+    /// channel to master and channel to send paths considered this
+    /// period, and how many of those weren't mixed because the
+    /// channel was silent, muted or had its gain at the bottom, or
+    /// the send's gain was. Cleared by the process thread each period.
+    unsigned int paths,pathsSkipped;
+
+private:
+    // a buffer while building: the level it is used at and where
+    // it is in the arena
+    struct BufInfo {
+        int level;
+        size_t offset;
+    };
+    std::unordered_map<BufferId,BufInfo> bufmap;
+    // the buffers which last from one block to the next, sorted by
+    // ID, with their memory in the arena
+    struct Persist {
+        BufferId id;
+        float *buf;
+    };
+    std::vector<Persist> persist;
+    // make the arena and put the buffers in it
+    void layoutBuffers();
+    // copy the contents of the lasting buffers from the graph being
+    // replaced, so feedback between effects carries on over a rebuild
+    void carryBuffers(const MixGraph *old);
+
+    // add channels and their sends
+    void addChans(std::vector<Chan>& out,const std::vector<Channel *>& in);
+    void mixChan(Chan& c,float *leftout,float *rightout,int offset,int nframes);
+    // run one branch of the current level, as a worker job
+    static void runBranch(void *ctx,int i);
+    // suspend or wake the chains of a level before they run, and
+    // afterwards see if they have gone quiet
+    void suspendChains(Level& l,int nframes);
+    void checkQuietChains(Level& l,int nframes);
+    // the level and block size runChains() is running
+    Level *fxLevel;
+    unsigned int fxFrames;
+
+    static std::atomic<MixGraph *> pending;
+    static MixGraph *current,*retiring;
+    static RingBuffer<MixGraph *> retired;
+    static unsigned int nextGen,liveGen;
+    static MeterMailbox *meterbox;
+};
+
+#endif /* __MIXGRAPH_H */
@@ -19,6 +19,8 @@
 #include "version.h"
 #include "colours.h"
 #include "ctrl.h"
+#include "mixgraph.h"
+#include "profile.h"
 
 #include "screenctrl.h"
 
@@ -132,7 +134,15 @@ void MonitorThread::loop(){
     // main loop
     while(1){
         // send commands from the UI thread to the process thread
-        Process::sendCmds();
+        string err = Process::sendCmds();
+        if(err.size())
+            setStatus(err,5);
+        
+        // that may have deleted channels, so drop old monitoring data
+        lock();
+        if(lastReceived.gen<MixGraph::getLiveGen())
+            lastReceived.chans.clear();
+        unlock();
         
         
         Screen *sc;
@@ -191,7 +201,6 @@ void MonitorThread::loop(){
                     lock();
                     req.aborted = newst==Aborted;
                     req.strout = lineEdit.consume();
-                    req.value->setTarget(atof(req.strout.c_str()));
                     req.setDone();
                     // signal the other thread
                     unlock();
@@ -217,7 +226,9 @@ void MonitorThread::loop(){
         // fetch any data and display it using the current screen
         static MonitorData mdat;
         static unsigned int monpackct=0;
-        if(Process::pollMonRing(&mdat)){
+        if(mdat.gen<MixGraph::getLiveGen())
+            mdat.chans.clear();
+        if(Process::pollMeters(&mdat)){
             // we only erase sometimes, because it's only sometimes that data appears here
             erase();
             sc->display(&mdat);
@@ -235,6 +246,14 @@ void MonitorThread::loop(){
         extern unsigned long diamondMsgCt;
         mvprintw(h-2,w-17,"%08u",diamondMsgCt);
         
+        // the DSP load, to the left of those; red once there's been
+        // an xrun
+        Process::pollLoad();
+        string load = LoadStats::status();
+        attrset(LoadStats::getXruns() ? COLOR_PAIR(PAIR_REDTEXT) : COLOR_PAIR(0));
+        mvaddstr(h-1,w-18-(int)load.size(),load.c_str());
+        attrset(COLOR_PAIR(0));
+        
         // do the display, first the screen
         
         // display line edit if any, then string list if any, then keyprompt if any,
@@ -358,5 +377,13 @@ void InputManager::editVal(string name,Value *v){
     pthread_cond_wait(&cond,&mutex);
     ///... some time later... the mutex will be locked
     string rv = req.strout;
+    bool aborted = req.aborted;
     unlock();
+    // the process thread sets the target, as it keeps track of
+    // which values are moving
+    if(!aborted){
+        ProcessCommand cmd(ProcessCommandType::SetValue);
+        cmd.setvalptr(v)->setfloat(atof(rv.c_str()));
+        Process::writeCmd(cmd);
+    }
 }
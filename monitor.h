@@ -1,9 +1,9 @@
 /**
  * @file monitor.h
  * @brief Graphical monitoring system. Monitor data is kept
- * in a block with data for all channels. This block is
- * sent from the processing thread to the main thread in
- * a ringbuffer. Data is displayed with curses.
+ * in a block with data for all channels, made from the meter
+ * readings the processing thread sends (see meters.h). Data
+ * is displayed with curses.
  *
  */
 
@@ -17,6 +17,8 @@
 #include "exception.h"
 #include "stack.h"
 #include "channel.h"
+#include "meters.h"
+#include "loudness.h"
 #include "timeutils.h"
 #include "lineedit.h"
 #include "stringlist.h"
@@ -27,16 +29,24 @@ using namespace std;
 
 extern class Screen *curscreen; // the current screen. LOCK IT.
 
+// the meter readings for a channel (see meters.h), with the channel
+// looked up for the display
 struct ChanMonData {
-    void init(string n,float _l,float _r,float g,float p,Channel *c){
-        l=_l; r=_r;
-        gain=g; pan=p;
-        strcpy(name,n.c_str());
+    void init(const string& n,const ChanMeter& m,Channel *c){
+        name=n;
+        l=m.l; r=m.r;
+        rmsl=m.rmsl; rmsr=m.rmsr;
+        holdl=m.holdl; holdr=m.holdr;
+        clipsl=m.clipsl; clipsr=m.clipsr;
+        gain=m.gain; pan=m.pan;
         chan=c;
     }
-    char name[256];
+    string name;
     // momentary values
     float l,r;
+    float rmsl,rmsr;
+    float holdl,holdr;
+    unsigned int clipsl,clipsr;
     // sources (don't read the actual value!)
     // these are actual values, but could be smoothed
     // so we can't use the get() data in the monitor thread
@@ -44,17 +54,22 @@ struct ChanMonData {
     Channel *chan;
 };
 
+// a loudness meter's readings, with the channel's name
+struct LoudnessData {
+    string name;
+    LoudnessReading r;
+};
+
 struct MonitorData {
-    ChanMonData master = {"MASTER",0,0,1,0.5,NULL};
-    // annoyingly the ring buffer doesn't like vectors or strings
-    int numchans=0;
-    ChanMonData chans[32];
-    
-    ChanMonData *add(){
-        if(numchans<32){
-            return chans+(numchans++);
-        } else return NULL;
-    }
+    ChanMonData master = {"MASTER",0,0,0,0,0,0,0,0,1,0.5,NULL};
+    // generation of the graph this came from; channel pointers from
+    // before MixGraph::getLiveGen() may be stale.
+    unsigned int gen=0;
+    vector<ChanMonData> chans;
+    // mix paths in the last period, and how many were skipped
+    unsigned int paths=0,pathsSkipped=0;
+    // the loudness meters which are on, the master first
+    vector<LoudnessData> loudness;
 };
 
 
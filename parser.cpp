@@ -17,6 +17,7 @@
 
 #include "diamond.h"
 #include "midi.h"
+#include "denormals.h"
 
 Tokeniser tok;
 
@@ -30,7 +31,7 @@ Value *parseValue(Bounds b,Value *v=NULL)
         v = new Value("");
     
     float rmin=0,rmax=1;
-    float smooth = 0.5;
+    float smoothms = DEFAULTSMOOTHMS;
     
     v->optsset=0;
     
@@ -54,7 +55,12 @@ Value *parseValue(Bounds b,Value *v=NULL)
             v->optsset|=VALOPTS_MAX;
             break;
         case T_SMOOTH:
-            smooth = tok.getnextfloat();
+            // old-style per-period factor
+            smoothms = Value::smoothFactorToMs(tok.getnextfloat());
+            if(tok.iserror())expected("number");
+            break;
+        case T_SMOOTHMS:
+            smoothms = tok.getnextfloat();
             if(tok.iserror())expected("number");
             break;
         case T_DEFAULT:
@@ -103,7 +109,7 @@ optsdone:
             expected("')'");
     } else
         tok.rewind();
-    v->setsmooth(smooth);
+    v->setsmoothms(smoothms);
     return v;
 }
 
@@ -140,10 +146,11 @@ void parseChan(){
     }
     
     // can now create the channel. The Channel class maintains
-    // a static list of channels to which the ctor will add the
+    // a static list of channels to which link() will add the
     // new one.
     Channel *ch = new Channel(name,mono?1:2,gain,pan,isReturn,
                               returnChainName);
+    ch->link();
     
     // add info about chains, which will be resolved later.
     while(tok.getnext()==T_SEND){
@@ -259,6 +266,13 @@ void parseConfigData(const char *s){
         case T_MASTER:
             parseMaster();
             break;
+        case T_DENORMALS:
+            switch(tok.getnext()){
+            case T_FLUSH:Denormals::flush=true;break;
+            case T_KEEP:Denormals::flush=false;break;
+            default:expected("'flush' or 'keep'");
+            }
+            break;
         case T_END:
             return;
         default:
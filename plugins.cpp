@@ -23,6 +23,8 @@
 #include "process.h"
 #include "ctrl.h"
 #include "plugins.h"
+#include "arena.h"
+#include "profile.h"
 
 const LADSPA_Descriptor *getLocal(unsigned long i,unsigned long j);
 
@@ -119,8 +121,12 @@ bool PluginData::getDefault(string pname,float *f){
 
 void PluginInstance::dump(){
     for(unsigned int i=0;i<p->desc->PortCount;i++){
-        float *paddr = connections[i];
-        printf("%d %p\n",i,paddr);
+        if(LADSPA_IS_PORT_CONTROL(p->desc->PortDescriptors[i]))
+            printf("%d %p\n",i,connections[i]);
+        else if(LADSPA_IS_PORT_OUTPUT(p->desc->PortDescriptors[i]))
+            printf("%d buffer %u\n",i,opbufs[i]);
+        else
+            printf("%d buffer %u\n",i,inbufs[i]);
     }
 }
 
@@ -206,14 +212,13 @@ PluginInstance::PluginInstance(PluginData *plugin,string n,string chainname) : p
             portsConnected[i]=true;
         }
         else if(LADSPA_IS_PORT_OUTPUT(p->desc->PortDescriptors[i])){
-            opbufs[i] = new float[BUFSIZE];
-//            cout << "Connecting OUTPUT port " << p->desc->PortNames[i]
-//                  << "(" << i << ") with " << opbufs[i] <<endl;
-            (*p->desc->connect_port)(h,i,opbufs[i]);
-            connections[i]=opbufs[i];
+            // just an ID; the process thread connects the port to
+            // the graph's buffer for it before running the plugin
+            opbufs[i] = Arena::newBufferId();
         }
     }
     isActive=false;
+    prof = new ProfStats();
     instances.push_back(this);
 }
 
@@ -223,20 +228,24 @@ PluginInstance::~PluginInstance(){
         (*p->desc->deactivate)(h);
     if(p->desc->cleanup)
         (*p->desc->cleanup)(h);
-    // delete output buffers
-    for(unsigned int i=0;i<p->desc->PortCount;i++){
-        if(LADSPA_IS_PORT_OUTPUT(p->desc->PortDescriptors[i])){
-            delete opbufs[i];
-        }
-    }
-    // delete values (should also delete control associations)
+    delete prof;
+    // delete values (should also delete control associations, but
+    // they've normally been detached by the process thread after
+    // unlinkValues())
     for(unsigned int i=0;i<paramsList.size();i++){
         Value *v = paramsMap[paramsList[i]];
-        Ctrl::removeAllAssociations(v);
+        if(v->getCtrl())
+            Ctrl::removeAllAssociations(v);
         delete v;
     }
 }
 
+void PluginInstance::unlinkValues(){
+    unordered_map<string,Value *>::iterator it;
+    for(it=paramsMap.begin();it!=paramsMap.end();it++)
+        it->second->unlink();
+}
+
 void PluginInstance::activate(){
     checkPortsConnected();
     if(p->desc->activate)
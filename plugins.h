@@ -10,6 +10,7 @@
 
 #include "ladspa.h"
 #include "bounds.h"
+#include "arena.h"
 
 #ifndef __PLUGINS_H
 #define __PLUGINS_H
@@ -37,10 +38,16 @@ public:
     // which ports are set correctly - we check before running
     vector<bool> portsConnected;
     
-    // maps output ports to their own buffer. Created in ctor.
-    unordered_map<int,float*> opbufs;
+    // maps output ports to their own buffer IDs (see Arena). Created
+    // in ctor.
+    unordered_map<int,BufferId> opbufs;
+    // maps audio input ports to the buffer IDs they read
+    unordered_map<int,BufferId> inbufs;
     unordered_map<int,float*> connections; // for debugging snark
     
+    // how long each run takes (see profile.h)
+    class ProfStats *prof;
+    
     // will instantiate, set default controls etc.
     PluginInstance(struct PluginData *plugin,string name,string chainname);
     // will deactivate if required/cleanup
@@ -52,6 +59,10 @@ public:
     // connect a port
     void connect(string name,float *v);
     
+    // remove the parameter values from the list of values updated
+    // each period, when the instance is taken out of a chain
+    void unlinkValues();
+    
     // dump all ports to stdout
     void dump();
 };
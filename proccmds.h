@@ -10,12 +10,14 @@
 
 // commands sent from main thread code (i.e. InputManager and screens
 // to processing thread, with the ProcessCommand elements they require
-// in the comment
+// in the comment. Commands which change the structure of the mix don't
+// actually reach the processing thread - see the comment on sendCmds().
 
 enum ProcessCommandType {
           NudgeValue,           // vp,v(amount)
           ChannelMute,          // chan
           ChannelSolo,          // chan
+          ToggleLoudness,       // chan
           DelChan,              // chan
           DelSend,              // chan,arg0(send index)
           TogglePrePost,        // chan,arg0(send index)
@@ -109,7 +111,7 @@ struct ProcessCommand {
         return this;
     }
     
-    
+
     ProcessCommand *setstr(std::string str){
         if(str.size()>STRSIZE) throw _("string too large");
         strcpy(s,str.c_str());
@@ -151,6 +153,9 @@ struct ProcessCommand {
     char s4[STRSIZE];
     
     struct PluginData *pld;
+    
+    // set by Process::writeCmd(), used to acknowledge the command
+    unsigned int seq;
 };
 
 
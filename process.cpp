@@ -9,6 +9,7 @@
 #include <unistd.h>
 #include <math.h>
 #include <stdint.h>
+#include <string.h>
 #include <string>
 #include <iostream>
 
@@ -25,7 +26,15 @@
 #include "diamond.h"
 
 #include "process.h"
+#include "kernels.h"
+#include "mixgraph.h"
 #include "midi.h"
+#include "workers.h"
+#include "arena.h"
+#include "meters.h"
+#include "loudness.h"
+#include "profile.h"
+#include "denormals.h"
 #include <jack/midiport.h>
 
 using namespace std;
@@ -35,20 +44,30 @@ static jack_port_t *midi_in;
 
 // statics of Process
 volatile bool Process::parsedAndReady=false;
-RingBuffer<MonitorData> Process::monring(20);
+bool Process::offline=false;
 RingBuffer<ProcessCommand> Process::moncmdring(20);
 RingBuffer<ProcessCommand> sendqueue(20);
 
 uint32_t Process::samprate=0;
-PeakMonitor Process::masterMonL("masterL"),Process::masterMonR("masterR");
+unsigned int Process::bufsize=BUFSIZE;
+std::atomic<unsigned int> Process::newBufsize(BUFSIZE);
+LevelMeter Process::masterMonL,Process::masterMonR;
 Value *Process::masterPan,*Process::masterGain;
 jack_client_t *Process::client=NULL;
+unsigned int Process::cmdsWritten=0;
+volatile sig_atomic_t Process::loadDumpRequested=0;
+std::atomic<unsigned int> Process::cmdsDone(0);
 
-// used to lock the UI while the process does its stuff
-static pthread_mutex_t cmdmutex = PTHREAD_MUTEX_INITIALIZER; 
-static pthread_cond_t cmdcond = PTHREAD_COND_INITIALIZER;
+// is sequence number a later than b? (allowing for wrapping)
+static inline bool seqAfter(unsigned int a,unsigned int b){
+    return (int)(a-b)>0;
+}
 
 void Process::init(){
+    // the buffer used for unconnected chain ports and outputs
+    extern BufferId zeroBuf;
+    zeroBuf = Arena::newBufferId();
+    
     masterGain = (new Value("master gain"))->
           setdb()->setdbrange()->setdef(0)->reset();
     masterPan = (new Value("master pan"))->
@@ -64,10 +83,15 @@ void Process::initJack(){
     
     if(samprate<10000)
         throw _("weird sample rate: %d",samprate);
+    LevelMeter::setRate(samprate);
+    
+    setPeriod(jack_get_buffer_size(client));
     
     // set callbacks
     jack_set_process_callback(client, callbackProcess, 0);
     jack_set_sample_rate_callback(client, callbackSrate, 0);
+    jack_set_buffer_size_callback(client, callbackBufsize, 0);
+    jack_set_xrun_callback(client, callbackXrun, 0);
     jack_on_shutdown(client, callbackShutdown, 0);
     
     midi_in = jack_port_register(client,
@@ -92,115 +116,273 @@ void Process::initJack(){
     }
 }
 
+void Process::setPeriod(unsigned int n){
+    if(n>BUFSIZE)n=BUFSIZE;
+    bufsize = n;
+    newBufsize.store(n);
+}
+
 void Process::shutdown(){
-    //    jack_deactivate(client);
+    // stop the process callback first, as it may be waiting for the
+    // workers to finish its jobs
+    if(client)
+        jack_deactivate(client);
+    Workers::shutdown();
+    Loudness::shutdown();
+    if(client)
+        LoadStats::dump(stdout);
+    if(Denormals::check.load())
+        Denormals::dump(stdout);
     //usleep(10000);
     //    jack_client_close(client);
     exit(0);
 }
 
-bool Process::pollMonRing(MonitorData *p){
-    bool rd=false;
-    //        printf("%ld\n",monring.getWriteSpace());
-    while(monring.getReadSpace()){
-        rd=true;
-        monring.read(*p);
+bool Process::pollMeters(MonitorData *p){
+    MeterMailbox *box = MixGraph::getMeters();
+    MeterBlock *b = box ? box->read() : NULL;
+    // skip data from graphs which have been freed, which might
+    // have had channels which have since been deleted
+    if(!b || b->gen<MixGraph::getLiveGen())
+        return false;
+    
+    p->gen = b->gen;
+    p->master.init("MASTER",b->master,NULL);
+    p->paths = b->paths;
+    p->pathsSkipped = b->pathsSkipped;
+    // channels deleted since are left out
+    p->chans.resize(b->numchans);
+    unsigned int n=0;
+    for(unsigned int i=0;i<b->numchans;i++){
+        Channel *ch = Channel::getChannelById(b->chans[i].id);
+        if(ch)
+            p->chans[n++].init(ch->name,b->chans[i],ch);
+    }
+    p->chans.resize(n);
+    
+    // and the loudness meters, which are read whenever there is new
+    // data even though they're updated less often
+    vector<LoudnessReading> r;
+    Loudness::getReadings(r);
+    p->loudness.clear();
+    for(unsigned int i=0;i<r.size();i++){
+        Channel *ch = r[i].id ? Channel::getChannelById(r[i].id) : NULL;
+        if(r[i].id && !ch)
+            continue;
+        LoudnessData d = {ch ? ch->name : "MASTER",r[i]};
+        p->loudness.push_back(d);
     }
-    return rd;
+    return true;
 }
 
 
-void Process::writeCmd(ProcessCommand cmd){
+unsigned int Process::writeCmd(ProcessCommand cmd){
     // queue a command
-    if(sendqueue.canWrite())
-        sendqueue.write(cmd);
+    if(!sendqueue.canWrite())
+        return 0;
+    cmd.seq = ++cmdsWritten;
+    // 0 means "not sent"
+    if(!cmd.seq)
+        cmd.seq = ++cmdsWritten;
+    sendqueue.write(cmd);
+    return cmd.seq;
 }
 
-void Process::sendCmds(){
-    while(sendqueue.getReadSpace()){
-        ProcessCommand cmd;
-        sendqueue.read(cmd);
-        if(moncmdring.canWrite()){
+bool Process::waitForCmds(double timeout){
+    Time end = Time()+Time(timeout);
+    while(!cmdDone(cmdsWritten)){
+        if(Time()>end)
+            return false;
+        usleep(1000);
+    }
+    return true;
+}
+
+string Process::sendCmds(){
+    string err;
+    
+    // free any graphs the process thread is done with, and anything
+    // removed from the model which they were using
+    MixGraph::collect();
+    
+    // if the last graph hasn't been picked up, everything else waits
+    if(MixGraph::isPending())
+        return err;
+    
+    // a controller waiting for midi input may have got it
+    bool learned = midi.pollLearn();
+    
+    // if the period size has changed, the next graph has new buffers;
+    // until the process thread picks it up it splits periods to fit
+    // the old.
+    bool resized=false;
+    unsigned int n = newBufsize.load();
+    if(n!=bufsize){
+        bufsize = n;
+        resized=true;
+    }
+    
+    unsigned int changed=0;
+    ProcessCommand cmd;
+    while(sendqueue.peek(cmd)){
+        if(isStructural(cmd)){
+            try {
+                applyCmd(cmd);
+            } catch(string s){
+                err=s;
+            }
+            // the graph is rebuilt even if that failed, so that
+            // the command is acknowledged.
+            changed=cmd.seq;
+        } else {
+            // anything after a change waits for its graph, and anything
+            // left over stays in the queue until there's room
+            if(changed || !moncmdring.canWrite())
+                break;
             moncmdring.write(cmd);
         }
+        sendqueue.read(cmd);
+    }
+    
+    // give the process thread the new graph
+    if(changed || learned || resized){
+        MixGraph *g = MixGraph::build();
+        g->cmdseq = changed ? changed : cmdsDone.load();
+        MixGraph::publish(g);
     }
-    // block until commands done
-    pthread_cond_wait(&cmdcond,&cmdmutex);
+    return err;
 }
 
 
 /*
- * Processing and callbacks
+ * Changes to the model, outside the process thread. Anything removed
+ * goes into the graveyard, to be deleted once the process thread has
+ * stopped using the last graph which referred to it.
  */
 
-void Process::processCommand(ProcessCommand& c){
+bool Process::isStructural(ProcessCommand& c){
     switch(c.cmd){
-    case Dummy:break;
-    case NudgeValue:
-        c.vp->nudge(c.v);
-        break;
-    case SetValue:
-        c.vp->setTarget(c.v);
-        break;
-    case ChannelMute:
-        c.chan->toggleMute();
-        break;
-    case ChannelSolo:
-        c.chan->toggleSolo();
-        break;
     case DelSend:
-        // awkward. 
-        c.chan->removeChainInfo(c.arg0);
+    case DelChan:
+    case AddSend:
+    case AddChannel:
+    case TogglePrePost:
+    case AddEffect:
+    case RemapInput:
+    case RemapOutput:
+    case AddChain:
+    case DeleteChain:
+    case DeleteEffect:
+    case NewCtrl:
+    case DeleteCtrl:
+    case ToggleLoudness:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void Process::applyCmd(ProcessCommand& c){
+    Graveyard& dead = MixGraph::graveyard;
+    switch(c.cmd){
+    case DelSend:{
+        Value *v = c.chan->removeChainInfo(c.arg0);
+        if(v)dead.values.push_back(v);
         break;
+    }
     case DelChan:
-        delete c.chan; // should remove from lists.
+        c.chan->unlink();
+        dead.chans.push_back(c.chan);
         break;
     case AddSend:{
-        // Will leave a dangling value. No biggie.
+        ChainInterface *ch = ChainInterface::find(c.s);
         Value *v = new Value(c.chan->name+"->"+c.s+" gain");
         v->setdb()->setdbrange()->setdef(0)->reset();
-        c.chan->addChainInfo(c.s,v,false,ChainInterface::find(c.s));
+        c.chan->addChainFeed(v,false,ch);
+        // a return can't send to its own chain, or one feeding it
+        try {
+            MixGraph::levelChains();
+        } catch(string s){
+            delete c.chan->removeChainInfo(c.chan->chains.size()-1);
+            throw;
+        }
         break;
     }
     case AddChannel:{
         char buf[128];
-        // Will leave 2 dangling values. Bit more biggie.
         snprintf(buf,128,"%s gain",c.s);
         Value *g = new Value(buf);
         g->setdb()->setdbrange()->setdef(0)->reset();
         snprintf(buf,128,"%s pan",c.s);
         Value *p = new Value(buf);
         p->setrange(0,1)->setdef(0.5)->reset();
-        new Channel(c.s,c.arg0,g,p,false);
-    } break;
+        (new Channel(c.s,c.arg0,g,p,false))->link();
+        break;
+    }
     case TogglePrePost:
         c.chan->chains[c.arg0].postfade=
               !c.chan->chains[c.arg0].postfade;
         break;
-    case AddEffect:{
-        ChainInterface *ch = chainlist[c.arg0];
-        ch->addEffect(c.pld,c.s);
-    } break;
-    case RemapInput:{
-        ChainInterface *ch = chainlist[c.arg0];
-        ch->remapInput(c.s,c.s2,c.arg1,c.s3,c.s4);
-    } break;
-    case RemapOutput:{
-        ChainInterface *ch = chainlist[c.arg0];
-        ch->remapOutput(c.arg1,c.s,c.s2);
+    case AddEffect:
+        chainlist[c.arg0]->addEffect(c.pld,c.s);
+        break;
+    case RemapInput:
+        chainlist[c.arg0]->remapInput(c.s,c.s2,c.arg1,c.s3,c.s4);
+        break;
+    case RemapOutput:
+        chainlist[c.arg0]->remapOutput(c.arg1,c.s,c.s2);
         break;
-    }
     case AddChain:
         ChainInterface::addNewEmptyChain(c.s);
         break;
     case DeleteChain:
-        ChainInterface::deleteChain(c.arg0);
+        ChainInterface::unlinkChain(c.arg0,dead);
         break;
     case DeleteEffect:
-        ChainInterface::deleteEffect(c.arg0,c.arg1);
+        ChainInterface::unlinkEffect(c.arg0,c.arg1,dead);
+        break;
+    case NewCtrl:
+        {
+            Ctrl *ctrl = Ctrl::createOrFind(c.s);
+            ctrl->setsource(c.source,c.s2);
+        }
         break;
     case DeleteCtrl:
-        delete c.ctrl;
+        c.ctrl->unlink();
+        dead.ctrls.push_back(c.ctrl);
+        break;
+    case ToggleLoudness:
+        if(c.chan->tap){
+            // the old graph may still be writing to it
+            Loudness::remove(c.chan->tap);
+            dead.taps.push_back(c.chan->tap);
+            c.chan->tap=NULL;
+        } else {
+            c.chan->tap = new LoudnessTap(c.chan->id);
+            Loudness::add(c.chan->tap);
+        }
+        break;
+    default:break;
+    }
+}
+
+/*
+ * Processing and callbacks
+ */
+
+void Process::processCommand(ProcessCommand& c){
+    switch(c.cmd){
+    case NudgeValue:
+        c.vp->nudge(c.v);
+        break;
+    case SetValue:
+        c.vp->setTarget(c.v);
+        break;
+    case ChannelMute:
+        c.chan->toggleMute();
+        break;
+    case ChannelSolo:
+        c.chan->toggleSolo();
         break;
     case DeleteCtrlAssoc:
         c.ctrl->remval(c.vp);
@@ -211,22 +393,23 @@ void Process::processCommand(ProcessCommand& c){
     case SetCtrlRangeDefault:
         c.ctrl->source->setrangedefault(c.ctrl);
         break;
-    case NewCtrl:
-        {
-            Ctrl *ctrl = Ctrl::createOrFind(c.s);
-            ctrl->setsource(c.source,c.s2);
-        }
-        break;
     case AddCtrl:
         c.ctrl->addval(c.vp);
         break;
+    default:break; // structural commands are done by applyCmd()
     }
 }
 
+int Process::callbackBufsize(jack_nframes_t nframes, void *arg){
+    newBufsize.store(nframes>BUFSIZE ? BUFSIZE : nframes);
+    return 0;
+}
+
 int Process::callbackSrate(jack_nframes_t nframes, void *arg)
 {
     printf("the sample rate is now %" PRIu32 "/sec\n", nframes);
     Process::samprate = nframes;
+    LevelMeter::setRate(nframes);
     return 0;
 }
 
@@ -234,64 +417,99 @@ void Process::callbackShutdown(void *arg){
     exit(1);
 }    
 
+int Process::callbackXrun(void *arg){
+    LoadStats::xrun();
+    return 0;
+}
+
+void Process::pollLoad(){
+    if(client)
+        LoadStats::sampleCpuLoad(jack_cpu_load(client));
+    if(loadDumpRequested){
+        loadDumpRequested=0;
+        LoadStats::dump(stderr);
+        Denormals::dump(stderr);
+    }
+}
+
+void Process::requestLoadDump(int sig){
+    loadDumpRequested=1;
+}
+
 static void *midbuf;
 static jack_nframes_t evct;
+// the next midi event to look at, so that each period's events are
+// walked through once.
+static jack_nframes_t evidx;
 
-void Process::subproc(float *left,float *right,
-                        jack_nframes_t offset,
-                        jack_nframes_t n){
-    // we can't check every damn frame whether a midi event has gone off,
-    //but we can at least check every subproc.
-    
-    for(unsigned int i=0;i<evct;i++){
+jack_nframes_t Process::feedMidi(MixGraph *g,jack_nframes_t until,
+                                 jack_nframes_t nframes){
+    while(evidx<evct){
         jack_midi_event_t e;
-        jack_midi_event_get(&e,midbuf,i);
+        jack_midi_event_get(&e,midbuf,evidx);
         jack_midi_data_t d = *(e.buffer);
-        if((d & 0xf0) == 0xb0){ // CC
-            if(e.time >=offset && e.time < offset+n){
-                // the event occurred in the correct time slot
-                int chan = d & 0xf;
-                int cn = e.buffer[1]; // cc number
-                int cv = e.buffer[2]; // value
-                
-//                printf("Midi got: chan %d, cc %d, val %d\n",chan,cn,cv);
-                
-                // pass this to the controllers
-                midi.feed(chan+1,cn,cv);
-            }
+        if((d & 0xf0) == 0xb0 && e.size>=3){ // CC
+            // stop at the first one we aren't due to do yet, which
+            // is where the next ramp will start.
+            if(e.time >= until)
+                return e.time<nframes ? e.time : nframes;
+            int chan = d & 0xf;
+            int cn = e.buffer[1]; // cc number
+            int cv = e.buffer[2]; // value
+            
+//            printf("Midi got: chan %d, cc %d, val %d\n",chan,cn,cv);
+            
+            // pass this to the controllers
+            midi.feed(g->midimap,chan+1,cn,cv);
         }
+        evidx++;
     }
-    
+    return nframes;
+}
+
+void Process::subproc(MixGraph *g,float *left,float *right,
+                        jack_nframes_t offset,
+                        jack_nframes_t n){
     // run through all the channels, converting to stereo and panning
     // as required, mixing them into stereo if needed. Add the resulting
     // stereo buffers into the output buffers.
     
-    static float tmpl[BUFSIZE],tmpr[BUFSIZE];
+    float *tmpl = g->mixl;
+    float *tmpr = g->mixr;
     
-    ChainInterface::zeroAllInputs();
+    uint64_t t0 = Profile::now();
+    g->zeroChainInputs(n);
     // get input channels and mix into buffers (including send chain inputs)
-    Channel::mixInputChannels(tmpl,tmpr,offset,n);
-    // process effects
-    ChainInterface::runAll(n);
-    // mix effects return channels into output
-    Channel::mixReturnChannels(tmpl,tmpr,offset,n);
+    g->mixInputs(tmpl,tmpr,offset,n);
+    Profile::phases[ProfInputs]->record(Profile::now()-t0);
+    // process effects, mixing their return channels into output and
+    // into any chains they send to
+    g->runChains(tmpl,tmpr,offset,n);
     
-    // finally set the output
-    panstereo(left+offset,right+offset,tmpl,tmpr,
-              masterPan->get(),masterGain->get(),n);
+    // finally set the output, ramping the master gain and pan.
+    t0 = Profile::now();
+    MixDest d;
+    float gl0,gr0,gl1,gr1;
+    BlockLevels pl,pr; // not used; the output is metered per period
+    pangains(false,masterPan->getStart(),masterGain->getStart(),&gl0,&gr0);
+    pangains(false,masterPan->get(),masterGain->get(),&gl1,&gr1);
+    d.l = left+offset;
+    d.r = right+offset;
+    d.setRamp(gl0,gr0,gl1,gr1,offset-Value::rampStart,Value::period);
+    memset(d.l,0,n*sizeof(float));
+    memset(d.r,0,n*sizeof(float));
+    Kernels::mix(tmpl,tmpr,n,&d,1,&pl,&pr);
+    Profile::phases[ProfMaster]->record(Profile::now()-t0);
 }
 
 int Process::callbackProcess(jack_nframes_t nframes, void *arg){
     if(!parsedAndReady)return 0;
+    uint64_t start = Profile::now();
     
     // get midi event buffer and count
     midbuf = jack_port_get_buffer(midi_in,nframes);
     evct=jack_midi_get_event_count(midbuf);
-    
-    // every now and then, read data out of the ring buffers and update
-    // the values (which use LPFs).
-    Ctrl::pollAllCtrlRings();
-    Value::updateAll();
+    evidx=0;
     
     float *outleft = 
           (jack_default_audio_sample_t *)jack_port_get_buffer(output[0],
@@ -300,42 +518,75 @@ int Process::callbackProcess(jack_nframes_t nframes, void *arg){
           (jack_default_audio_sample_t *)jack_port_get_buffer(output[1],
                                                               nframes);
     
+    run(outleft,outright,nframes);
+    LoadStats::recordCallback(Profile::now()-start,nframes,samprate);
+    return 0;
+}
+
+void Process::run(float *outleft,float *outright,jack_nframes_t nframes){
+    // pick up any new graph
+    MixGraph *g = MixGraph::acquire();
+    Denormals::apply();
+    
     // just stores the pointers to the buffers for quick access in processing;
     // they don't survive across process() calls.
-    Channel::cacheAllChannelBuffers(nframes);
+    if(!offline)
+        g->cacheInputBuffers(nframes);
+    g->paths=g->pathsSkipped=0;
     
-    // we split the buffer into chunks we know are of a certain size
-    // to avoid having to play silly buggers with memory allocation
-    unsigned int i;
-    for(i=0;i<nframes-BUFSIZE;i+=BUFSIZE){
-        subproc(outleft+i,outright+i,i,BUFSIZE);
+    // the period is split into ramps at the frames where midi
+    // controller changes arrive, so that values start moving
+    // towards them there rather than at the next period.
+    jack_nframes_t start=0;
+    while(start<nframes){
+        jack_nframes_t end = feedMidi(g,start+MINRAMP,nframes);
+        
+        // read data out of the ring buffers and update the values
+        // (which use LPFs).
+        g->pollCtrls();
+        g->updateValues(start,end-start,samprate);
+        
+        // we split the buffer into chunks which fit the graph's
+        // buffers, which are normally the size of the period.
+        jack_nframes_t i;
+        for(i=start;i+g->bufsize<end;i+=g->bufsize){
+            subproc(g,outleft,outright,i,g->bufsize);
+        }
+        subproc(g,outleft,outright,i,end-i);
+        start=end;
     }
-    subproc(outleft+i,outright+i,i,nframes-i);
-    
-    masterMonL.in(outleft,nframes);
-    masterMonR.in(outright,nframes);
     
+    BlockLevels lvl,lvr;
+    Kernels::levels(outleft,outright,nframes,&lvl,&lvr);
+    masterMonL.in(lvl,1,nframes);
+    masterMonR.in(lvr,1,nframes);
+    if(Loudness::master)
+        Loudness::master->write(outleft,outright,nframes,1,1,1,1,0,1);
     
-    // write to the monitoring ring buffer
-    
-    if(monring.getWriteSpace()>3){
-        MonitorData m;
-        m.master.l = masterMonL.get();
-        m.master.r = masterMonR.get();
-        m.master.gain = masterGain->getNoDBConvert();
-        m.master.pan = masterPan->get();
-        Channel::writeMons(&m);
-        monring.write(m);
-    }
+    // send the meter readings to the display
+    MeterBlock *m = g->meters->getWriteBlock();
+    m->master.id = 0;
+    m->master.setLevels(masterMonL,masterMonR);
+    m->master.gain = masterGain->getNoDBConvert();
+    m->master.pan = masterPan->get();
+    g->writeMeters(m);
+    g->meters->publish();
     
-    // read any commands from the monitor
+    // read any commands from the monitor. Commands sent before a graph
+    // was published may arrive after we've picked it up, so the
+    // acknowledgement is whichever is later.
+    unsigned int done = cmdsDone.load(std::memory_order_relaxed);
+    if(seqAfter(g->cmdseq,done))
+        done = g->cmdseq;
     ProcessCommand cmd;
     while(moncmdring.getReadSpace()){
         moncmdring.read(cmd);
         processCommand(cmd);
+        if(seqAfter(cmd.seq,done))
+            done = cmd.seq;
     }
-    pthread_cond_signal(&cmdcond);
-    
-    return 0;
+    // pass back any graph we've replaced, now that we've done any
+    // commands sent before its replacement was published.
+    MixGraph::release();
+    cmdsDone.store(done,std::memory_order_release);
 }
-
@@ -9,23 +9,39 @@
 #ifndef __PROCESS_H
 #define __PROCESS_H
 
+#include <atomic>
+#include <signal.h>
+
 #include "ringbuffer.h"
 #include "monitor.h"
 #include "proccmds.h"
 
+// the shortest ramp a period is split into at midi controller
+// changes; changes closer together than this are done together.
+#define MINRAMP 16
+
 struct Process {
     static jack_client_t *client;
 
     static volatile bool parsedAndReady;
-    // process thread -> main thread, monitoring data
-    static RingBuffer<MonitorData> monring;
+    /// true if we are rendering from files rather than running
+    /// under jack; no ports are registered.
+    static bool offline;
     // main thread -> process thread, commands
     static RingBuffer<ProcessCommand> moncmdring;
     /// sample rate 
     static uint32_t samprate;
+    /// the size chain and effect buffers are allocated at: the
+    /// period size, up to BUFSIZE. Only changed outside the process
+    /// thread; the process thread uses MixGraph::bufsize.
+    static unsigned int bufsize;
     
-    /// peak monitors for the master channel
-    static PeakMonitor masterMonL,masterMonR;
+    /// set the period size before anything is created (for jack this
+    /// is done in initJack(), and after that by callbackBufsize()).
+    static void setPeriod(unsigned int n);
+    
+    /// meters for the master channel
+    static LevelMeter masterMonL,masterMonR;
     // have to be ptrs so they get registered
     static Value *masterPan,*masterGain;
     
@@ -38,39 +54,97 @@ struct Process {
     // force a shutdown
     static void shutdown();
     
-    // poll the monitoring ring from the main thread; gives
-    // the last block of data from the ring. returns false if
-    // no data present.
-    static bool pollMonRing(MonitorData *p);
+    // poll the meters from the main thread; gives the latest
+    // readings, with the channels looked up. returns false if
+    // there are none since the last call.
+    static bool pollMeters(MonitorData *p);
+    
+    // sample jack's DSP load from the main thread, and print the load
+    // stats (see profile.h) if asked to by requestLoadDump().
+    static void pollLoad();
+    // a signal handler asking for the load stats
+    static void requestLoadDump(int sig);
     
     /// add a command to be communicated to the process thread.
     /// Actually queues commands to be sent with sendCmds(),
-    /// which is done in the display thread.
-    static void writeCmd(ProcessCommand cmd);
+    /// which is done in the display thread. Returns a sequence
+    /// number for cmdDone(), or 0 if the queue was full and the
+    /// command was dropped. Only call from the main thread.
+    static unsigned int writeCmd(ProcessCommand cmd);
+    
+    /// true once the process thread has acted on the command with
+    /// this sequence number, and on all those before it.
+    static bool cmdDone(unsigned int seq){
+        return (int)(cmdsDone.load(std::memory_order_acquire)-seq)>=0;
+    }
+    
+    /// wait, from the main thread, for all the commands written so
+    /// far to be done. Returns false if that took longer than
+    /// timeout seconds (for example, if jack has stopped).
+    static bool waitForCmds(double timeout);
+    
+    /// called from the display thread, and never blocks. Commands
+    /// which change the structure of the mix (channels, sends, chains,
+    /// effects) are applied to the model here and a new MixGraph is
+    /// published; the rest are copied into the process queue. Commands
+    /// after a structural change wait until the process thread has
+    /// picked up its graph, so that everything happens in order. Also
+    /// frees old graphs. Returns an error message if a command failed.
+    static std::string sendCmds();
     
-    /// called from the display thread - copies commands into the process queue
-    /// and blocks that thread until processing is done.
-    static void sendCmds();
     
     
     
+    // true if a command changes the structure of the mix, and so
+    // is done by applyCmd() rather than the process thread
+    static bool isStructural(ProcessCommand& c);
+    
+    // apply a structural command to the model, in the display
+    // thread. Can throw.
+    static void applyCmd(ProcessCommand& c);
     
     // handle a command coming in on the command ring buffer
     static void processCommand(ProcessCommand& c);
     
+    // sequence numbers of the last command written by writeCmd(),
+    // and of the last one the process thread has done.
+    static unsigned int cmdsWritten;
+    static std::atomic<unsigned int> cmdsDone;
+    
+    
+    // the buffer size jack has asked for, which the display thread
+    // builds the next graph's buffers at
+    static std::atomic<unsigned int> newBufsize;
     
     // sample rate change callback
     static int callbackSrate(jack_nframes_t nframes, void *arg);
     
+    // buffer size change callback
+    static int callbackBufsize(jack_nframes_t nframes, void *arg);
+    
     // callback for when jack shuts down
     static void callbackShutdown(void *arg);
+    
+    // xrun callback
+    static int callbackXrun(void *arg);
+    static volatile sig_atomic_t loadDumpRequested;
         
 
+    // feed midi controller changes before frame "until" to the
+    // controllers, returning the frame of the next one (or nframes).
+    static jack_nframes_t feedMidi(struct MixGraph *g,jack_nframes_t until,
+                                   jack_nframes_t nframes);
+
     // this is called repeatedly by process to do the mixing.
-    static void subproc(float *left,float *right,
+    static void subproc(struct MixGraph *g,float *left,float *right,
                         jack_nframes_t offset,
                         jack_nframes_t n);
     
+    // run one period of the whole mix graph into the given output
+    // buffers. When offline, input channel buffers must already have
+    // been set with setInputBuffers().
+    static void run(float *outleft,float *outright,jack_nframes_t nframes);
+    
     // the main process - static so it's just a function and can
     // be used as a callback
     static int callbackProcess(jack_nframes_t nframes, void *arg);
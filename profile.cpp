@@ -0,0 +1,193 @@
+/**
+ * @file profile.cpp
+ * @brief DSP cost profiling.
+ *
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <new>
+
+#include "profile.h"
+#include "timeutils.h"
+
+std::atomic<unsigned int> ProfStats::curEpoch(0);
+double Profile::ticksPerUs=1000;
+ProfStats *Profile::phases[NUMPROFPHASES]={
+    new ProfStats(),new ProfStats(),new ProfStats(),new ProfStats()
+};
+const char *Profile::phaseNames[NUMPROFPHASES]={
+    "input mix","chains","returns","master"
+};
+
+ProfStats::ProfStats(){
+    pending.store(0);
+    clear(curEpoch.load());
+}
+
+void *ProfStats::operator new(size_t n){
+    void *p;
+    if(posix_memalign(&p,64,n))
+        throw std::bad_alloc();
+    return p;
+}
+
+void ProfStats::operator delete(void *p){
+    free(p);
+}
+
+void ProfStats::clear(unsigned int e){
+    count.store(0,std::memory_order_relaxed);
+    total.store(0,std::memory_order_relaxed);
+    min.store(UINT64_MAX,std::memory_order_relaxed);
+    max.store(0,std::memory_order_relaxed);
+    denormals.store(0,std::memory_order_relaxed);
+    for(int i=0;i<PROFBUCKETS;i++)
+        hist[i].store(0,std::memory_order_relaxed);
+    epoch.store(e,std::memory_order_relaxed);
+}
+
+void ProfStats::get(ProfSummary& s){
+    double k = 1.0/Profile::ticksPerUs;
+    // nothing since the reset, even if the counters haven't been
+    // cleared yet
+    if(epoch.load(std::memory_order_relaxed)!=curEpoch.load() ||
+       !(s.count = count.load(std::memory_order_relaxed))){
+        s.count=0;
+        s.min=s.avg=s.p99=s.max=s.total=0;
+        s.denormals=0;
+        return;
+    }
+    s.denormals = denormals.load(std::memory_order_relaxed);
+    uint64_t mx = max.load(std::memory_order_relaxed);
+    s.total = total.load(std::memory_order_relaxed)*k;
+    s.min = min.load(std::memory_order_relaxed)*k;
+    s.max = mx*k;
+    s.avg = s.total/s.count;
+
+    // the 99th percentile is somewhere in the bucket which takes the
+    // count past 99%; use the top of it.
+    uint64_t target = s.count-s.count/100;
+    uint64_t n=0;
+    int b;
+    for(b=0;b<PROFBUCKETS-1;b++){
+        n += hist[b].load(std::memory_order_relaxed);
+        if(n>=target)break;
+    }
+    uint64_t top = ProfStats::bucketStart(b+1);
+    s.p99 = (top<mx ? top : mx)*k;
+}
+
+void Profile::init(){
+    // time the counter against the clock
+    Time t0;
+    uint64_t c0 = now();
+    usleep(20000);
+    uint64_t c1 = now();
+    double secs = Time()-t0;
+    if(secs>0 && c1>c0)
+        ticksPerUs = (c1-c0)/(secs*1e6);
+}
+
+void Profile::reset(){
+    ProfStats::curEpoch.fetch_add(1);
+    // the display's side of the load stats
+    LoadStats::xruns.store(0);
+    LoadStats::cpuMax=0;
+    LoadStats::cpuSum=0;
+    LoadStats::cpuSamples=0;
+}
+
+unsigned int LoadStats::epoch=0;
+std::atomic<uint32_t> LoadStats::hist[LOADBUCKETS];
+std::atomic<uint64_t> LoadStats::callbacks(0);
+std::atomic<uint32_t> LoadStats::overruns(0);
+std::atomic<float> LoadStats::worst(0);
+std::atomic<uint32_t> LoadStats::xruns(0);
+float LoadStats::cpuLoad=0,LoadStats::cpuMax=0;
+double LoadStats::cpuSum=0;
+unsigned int LoadStats::cpuSamples=0;
+
+void LoadStats::recordCallback(uint64_t cycles,unsigned int nframes,
+                               unsigned int samprate){
+    unsigned int e = ProfStats::curEpoch.load(std::memory_order_relaxed);
+    if(e!=epoch){
+        for(int i=0;i<LOADBUCKETS;i++)
+            hist[i].store(0,std::memory_order_relaxed);
+        callbacks.store(0,std::memory_order_relaxed);
+        overruns.store(0,std::memory_order_relaxed);
+        worst.store(0,std::memory_order_relaxed);
+        epoch=e;
+    }
+    double deadline = nframes*1e6/samprate*Profile::ticksPerUs;
+    float f = (float)(cycles/deadline);
+    int b = (int)(f*20);
+    if(b>=LOADBUCKETS)b=LOADBUCKETS-1;
+    // only this thread writes these
+    hist[b].store(hist[b].load(std::memory_order_relaxed)+1,
+                  std::memory_order_relaxed);
+    callbacks.store(callbacks.load(std::memory_order_relaxed)+1,
+                    std::memory_order_relaxed);
+    if(f>1)
+        overruns.store(overruns.load(std::memory_order_relaxed)+1,
+                       std::memory_order_relaxed);
+    if(f>worst.load(std::memory_order_relaxed))
+        worst.store(f,std::memory_order_relaxed);
+}
+
+void LoadStats::sampleCpuLoad(float load){
+    cpuLoad = load;
+    if(load>cpuMax)cpuMax=load;
+    cpuSum+=load;
+    cpuSamples++;
+}
+
+int LoadStats::percentile(double frac){
+    uint64_t n = callbacks.load(std::memory_order_relaxed);
+    uint64_t target = (uint64_t)(n*frac);
+    uint64_t count=0;
+    int b;
+    for(b=0;b<LOADBUCKETS-1;b++){
+        count += hist[b].load(std::memory_order_relaxed);
+        if(count>=target)break;
+    }
+    return (b+1)*5;
+}
+
+std::string LoadStats::status(){
+    char buf[128];
+    if(!callbacks.load(std::memory_order_relaxed))
+        snprintf(buf,128,"DSP %2.0f%% xruns %u",cpuLoad,xruns.load());
+    else
+        snprintf(buf,128,"DSP %2.0f%% max %2.0f%%  cb p99 %d%% max %.0f%%  xruns %u",
+                 cpuLoad,cpuMax,percentile(0.99),
+                 worst.load(std::memory_order_relaxed)*100,xruns.load());
+    return buf;
+}
+
+void LoadStats::dump(FILE *f){
+    uint64_t n = callbacks.load(std::memory_order_relaxed);
+    fprintf(f,"Process callback time, as a percentage of the period "
+            "(%llu callbacks):\n",(unsigned long long)n);
+    if(n){
+        for(int i=0;i<LOADBUCKETS;i++){
+            uint32_t c = hist[i].load(std::memory_order_relaxed);
+            if(!c)continue;
+            if(i==LOADBUCKETS-1)
+                fprintf(f,"   over %3d%%",i*5);
+            else
+                fprintf(f,"  %3d-%3d%%  ",i*5,i*5+5);
+            fprintf(f," %10u %6.2f%%\n",c,c*100.0/n);
+        }
+        fprintf(f,"  p50 %d%%, p99 %d%%, p99.9 %d%%, worst %.1f%%, "
+                "%u over the deadline\n",
+                percentile(0.5),percentile(0.99),percentile(0.999),
+                worst.load(std::memory_order_relaxed)*100,
+                overruns.load(std::memory_order_relaxed));
+    }
+    fprintf(f,"xruns: %u\n",xruns.load());
+    if(cpuSamples)
+        fprintf(f,"jack DSP load: last %.1f%%, mean %.1f%%, max %.1f%%\n",
+                cpuLoad,cpuSum/cpuSamples,cpuMax);
+}
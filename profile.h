@@ -0,0 +1,199 @@
+/**
+ * @file profile.h
+ * @brief DSP cost profiling: how long each effect, each chain and each
+ * phase of the mix takes, timed with the CPU's cycle counter. Each set
+ * of counters is only ever written by the one thread running the thing
+ * it counts at the time, so no locks are needed, and each sits on its
+ * own cache lines so threads running different effects don't share.
+ * Also the time each process callback takes against its deadline, and
+ * the xruns.
+ *
+ */
+
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <atomic>
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+// histogram buckets, four to an octave of cycles
+#define PROFBUCKETS 128
+
+/// a summary of some counters, in microseconds
+struct ProfSummary {
+    uint64_t count;
+    double min,avg,p99,max;
+    /// the total, for working out the share of the CPU
+    double total;
+    /// subnormal outputs, if the denormal check is on
+    uint64_t denormals;
+};
+
+/// the costs of one thing
+class ProfStats {
+    // the epoch the counters were last cleared in
+    std::atomic<unsigned int> epoch;
+    std::atomic<uint64_t> count,total,min,max;
+    std::atomic<uint32_t> hist[PROFBUCKETS];
+    std::atomic<uint64_t> denormals;
+    // cycles added by several threads, waiting to be recorded as one
+    // go (see add())
+    std::atomic<uint64_t> pending;
+
+    void clear(unsigned int e);
+public:
+    ProfStats();
+
+    // these are kept on their own cache lines
+    static void *operator new(size_t n);
+    static void operator delete(void *p);
+
+    /// record how long something took
+    void record(uint64_t cycles){
+        unsigned int e = epoch.load(std::memory_order_relaxed);
+        if(e!=curEpoch.load(std::memory_order_relaxed))
+            clear(curEpoch.load(std::memory_order_relaxed));
+        // only this thread writes, so no need for read-modify-write
+        count.store(count.load(std::memory_order_relaxed)+1,
+                    std::memory_order_relaxed);
+        total.store(total.load(std::memory_order_relaxed)+cycles,
+                    std::memory_order_relaxed);
+        if(cycles<min.load(std::memory_order_relaxed))
+            min.store(cycles,std::memory_order_relaxed);
+        if(cycles>max.load(std::memory_order_relaxed))
+            max.store(cycles,std::memory_order_relaxed);
+        std::atomic<uint32_t>& h = hist[bucket(cycles)];
+        h.store(h.load(std::memory_order_relaxed)+1,
+                std::memory_order_relaxed);
+    }
+
+    /// count the subnormal numbers an effect made, after record() for
+    /// the same run (see denormals.h)
+    void addDenormals(unsigned int n){
+        denormals.store(denormals.load(std::memory_order_relaxed)+n,
+                        std::memory_order_relaxed);
+    }
+
+    /// add part of something run by several threads at once (a chain's
+    /// branches); flush() records the total once they have all finished.
+    void add(uint64_t cycles){
+        pending.fetch_add(cycles,std::memory_order_relaxed);
+    }
+    void flush(){
+        uint64_t c = pending.exchange(0,std::memory_order_relaxed);
+        if(c)record(c);
+    }
+
+    /// called from the display: the counters since the last reset
+    void get(ProfSummary& s);
+
+    /// the bucket for a time, and the shortest time in a bucket
+    static int bucket(uint64_t cycles){
+        if(cycles<4)return (int)cycles;
+        int l = 63-__builtin_clzll(cycles);
+        int b = l*4+(int)((cycles>>(l-2))&3)-4;
+        return b<PROFBUCKETS ? b : PROFBUCKETS-1;
+    }
+    static uint64_t bucketStart(int b){
+        if(b<4)return b;
+        b+=4;
+        return (uint64_t)(4+(b&3))<<(b/4-2);
+    }
+
+    /// bumped to reset all the counters; each is cleared the next time
+    /// it records something
+    static std::atomic<unsigned int> curEpoch;
+};
+
+/// the parts of a block of the mix
+enum ProfPhase {
+    ProfInputs,     // mixing the input channels
+    ProfChains,     // running the effects
+    ProfReturns,    // mixing the return channels
+    ProfMaster,     // the master gain and pan
+    NUMPROFPHASES
+};
+
+struct Profile {
+    /// work out how fast the cycle counter goes
+    static void init();
+
+    /// read the cycle counter
+    static uint64_t now(){
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        timespec t;
+        clock_gettime(CLOCK_MONOTONIC,&t);
+        return (uint64_t)t.tv_sec*1000000000ULL+t.tv_nsec;
+#endif
+    }
+
+    /// reset all the counters, including the LoadStats
+    static void reset();
+
+    /// counter ticks per microsecond
+    static double ticksPerUs;
+
+    /// the phases of each block, written by the process thread
+    static ProfStats *phases[NUMPROFPHASES];
+    static const char *phaseNames[NUMPROFPHASES];
+};
+
+// callback time histogram buckets: 5% of the period each up to 200%,
+// then one for anything longer
+#define LOADBUCKETS 41
+
+/// how long each process callback takes against its deadline (the
+/// period), the xruns, and jack's own DSP load estimate. The histogram
+/// is only written by the process thread; it is cleared, like the
+/// ProfStats, when the process thread sees a new epoch.
+struct LoadStats {
+    /// called at the end of each process callback
+    static void recordCallback(uint64_t cycles,unsigned int nframes,
+                               unsigned int samprate);
+    /// called from jack's xrun callback
+    static void xrun(){
+        xruns.fetch_add(1,std::memory_order_relaxed);
+    }
+    static unsigned int getXruns(){
+        return xruns.load(std::memory_order_relaxed);
+    }
+    /// called from the display with jack_cpu_load()
+    static void sampleCpuLoad(float load);
+
+    /// a line for the status area
+    static std::string status();
+    /// print everything
+    static void dump(FILE *f);
+
+private:
+    friend struct Profile;
+    static unsigned int epoch;
+    static std::atomic<uint32_t> hist[LOADBUCKETS];
+    static std::atomic<uint64_t> callbacks;
+    // callbacks which took longer than the period
+    static std::atomic<uint32_t> overruns;
+    // the longest callback, as a fraction of the period
+    static std::atomic<float> worst;
+    static std::atomic<uint32_t> xruns;
+    // the display's jack_cpu_load() samples
+    static float cpuLoad,cpuMax;
+    static double cpuSum;
+    static unsigned int cpuSamples;
+
+    // the percentage of the period within which a fraction of the
+    // callbacks finished (the top of the bucket)
+    static int percentile(double frac);
+};
+
+#endif /* __PROFILE_H */
@@ -0,0 +1,120 @@
+/**
+ * @file render.cpp
+ * @brief Offline rendering of the mix graph from and to WAV files.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "channel.h"
+#include "exception.h"
+#include "stringsplit.h"
+#include "timeutils.h"
+#include "process.h"
+#include "wav.h"
+#include "render.h"
+#include "loudness.h"
+#include "denormals.h"
+
+using namespace std;
+
+static vector<WavFile *> inputs;
+
+void Render::loadInputs(string list){
+    vector<string> names = split(list,',');
+    if(names.size()==0)
+        throw _("no input files to render");
+    
+    for(unsigned int i=0;i<names.size();i++){
+        WavFile *w = new WavFile(names[i]);
+        if(i && w->samprate != inputs[0]->samprate){
+            string err = _("sample rate of '%s' (%d) does not match '%s' (%d)",
+                           w->name.c_str(),w->samprate,
+                           inputs[0]->name.c_str(),inputs[0]->samprate);
+            delete w;
+            throw err;
+        }
+        cout << "Render input " << i << ": " << w->name << ", " <<
+              w->numchans << " channel(s), " << w->numframes << " frames" << endl;
+        inputs.push_back(w);
+    }
+    Process::samprate = inputs[0]->samprate;
+    LevelMeter::setRate(Process::samprate);
+}
+
+void Render::run(string outfile,unsigned int period){
+    int numchans = Channel::getNumInputChannels();
+    if((int)inputs.size() > numchans)
+        throw _("%d input files but only %d input channels",
+                (int)inputs.size(),numchans);
+    if((int)inputs.size() < numchans)
+        cout << "Warning: only " << inputs.size() << " input files for " <<
+              numchans << " input channels, the rest will be silent" << endl;
+    
+    unsigned int length=0;
+    for(unsigned int i=0;i<inputs.size();i++){
+        if(inputs[i]->numframes>length)
+            length=inputs[i]->numframes;
+    }
+    
+    // each channel gets a pair of scratch buffers, which we copy each
+    // period into. These are zero past the end of the shorter files.
+    unsigned int bufsize = period;
+    vector<float> scratch(numchans*2*bufsize,0.0f);
+    vector<float> outl(period),outr(period);
+    
+    WavWriter out(outfile,Process::samprate);
+    
+    Time start;
+    for(unsigned int pos=0;pos<length;pos+=period){
+        unsigned int n = length-pos;
+        if(n>period)n=period;
+        
+        for(int c=0;c<numchans;c++){
+            Channel *ch = Channel::getInputChannel(c);
+            float *l = &scratch[c*2*bufsize];
+            float *r = l+bufsize;
+            memset(l,0,bufsize*2*sizeof(float));
+            if(c<(int)inputs.size()){
+                WavFile *w = inputs[c];
+                // a mono file feeding a stereo channel goes to both sides
+                float *src[2];
+                src[0] = w->getChannel(0);
+                src[1] = w->numchans>1 ? w->getChannel(1) : src[0];
+                if(pos<w->numframes){
+                    unsigned int m = w->numframes-pos;
+                    if(m>n)m=n;
+                    memcpy(l,src[0]+pos,m*sizeof(float));
+                    memcpy(r,src[1]+pos,m*sizeof(float));
+                }
+            }
+            ch->setInputBuffers(l,ch->isMono() ? NULL : r);
+        }
+        
+        Process::run(&outl[0],&outr[0],n);
+        Loudness::process();
+        out.write(&outl[0],&outr[0],n);
+    }
+    double secs = Time()-start;
+    out.close();
+    
+    double audiosecs = (double)length/(double)Process::samprate;
+    printf("Rendered %u frames (%.2fs of audio) in %.3fs: "
+           "%.0f frames/s, %.1fx realtime\n",
+           length,audiosecs,secs,
+           secs>0 ? length/secs : 0.0,
+           secs>0 ? audiosecs/secs : 0.0);
+    
+    // the master's loudness comes first
+    vector<LoudnessReading> r;
+    Loudness::getReadings(r);
+    if(r.size() && r[0].integrated>LOUDNESS_NONE)
+        printf("Integrated loudness %.1f LUFS, true peak %.1f dBTP\n",
+               r[0].integrated,r[0].maxtruepeak);
+    if(Denormals::check.load())
+        Denormals::dump(stdout);
+}
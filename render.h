@@ -0,0 +1,32 @@
+/**
+ * @file render.h
+ * @brief Offline rendering: runs the full mix graph from WAV files
+ * into a WAV file as fast as possible, with no jack server. Useful for
+ * regression testing and profiling a config.
+ *
+ */
+
+#ifndef __RENDER_H
+#define __RENDER_H
+
+#include <string>
+#include <vector>
+
+struct Render {
+    // default period size, in frames, used when rendering
+    static const unsigned int DEFAULTPERIOD=256;
+    // and the largest allowed
+    static const int MAXPERIOD=65536;
+    
+    /// load the input files, given as a comma-separated list, and set
+    /// the sample rate from them. Call before parsing the config, because
+    /// plugin parameter bounds depend on the sample rate.
+    static void loadInputs(std::string list);
+    
+    /// feed the input files to the input channels in order, run the
+    /// graph a period at a time and write the master output to a file.
+    /// Prints the frames per second achieved.
+    static void run(std::string outfile,unsigned int period);
+};
+
+#endif /* __RENDER_H */
@@ -105,6 +105,22 @@ public:
         return true;
     }
     
+    /**
+       @brief Peek at the next item
+       
+       Copy the next item into a variable without removing it from
+       the buffer.
+       
+       \param dest an item to be copied into
+     */
+    bool peek(Type &dest){
+        if(getReadSpace() <= 0){
+            return false;
+        }
+        jack_ringbuffer_peek(mRingBufferPtr, (char *)&dest, sizeof(Type));
+        return true;
+    }
+    
     /**
        @brief Read into an array
        
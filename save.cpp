@@ -19,6 +19,7 @@
 #include "parser.h"
 #include "process.h"
 #include "save.h"
+#include "denormals.h"
 
 using namespace std;
 
@@ -39,6 +40,8 @@ void saveConfig(const char *fn){
         out << "plugindir \"" << *it << "\"\n";
     }
     
+    if(!Denormals::flush.load())
+        out << "denormals keep\n";
     saveMaster(out);
     
     Channel::saveAll(out);
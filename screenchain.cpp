@@ -9,6 +9,7 @@
 
 #include "screenmain.h"
 #include "screenchain.h"
+#include "screenprof.h"
 
 #include <sstream>
 #include <ncurses.h>
@@ -35,7 +36,9 @@ static ChainListMode chainListMode=Chain;
 
 static void signalRegen(InputManager *im){
     im->setStatus("REGENERATING",1);
-    usleep(10000);
+    // make sure any change we've asked for has been made
+    if(!Process::waitForCmds(1))
+        im->setStatus("changes not done yet - is jack running?",3);
     forceRegen=true;
 }
 
@@ -401,6 +404,10 @@ void ChainScreen::flow(InputManager *im){
             }
         }
         break;
+    case 'P':
+        im->push();
+        im->go(&scrProf);
+        break;
     case 'i':
         remapInput(im);
         break;
@@ -12,20 +12,26 @@
 #include "screenchan.h"
 
 #include <ncurses.h>
+#include <math.h>
 #include <sstream>
 
 ChanScreen scrChan;
 
+// a level in dB, for the readouts
+static float todb(float v){
+    return v<1e-6f ? -120.0f : 20.0f*log10f(v);
+}
+
 void ChanScreen::display(MonitorData *d){
     title("CHANNEL EDIT");
     attrset(COLOR_PAIR(PAIR_HILIGHT)|A_BOLD);
     
-    if(chanidx<0 || chanidx>=d->numchans){
+    if(chanidx<0 || chanidx>=(int)d->chans.size()){
         mvprintw(0,0,"Invalid channel");
     } else {
         int w = MonitorThread::get()->w;
         
-        ChanMonData *c = d->chans+chanidx;
+        ChanMonData *c = &d->chans[chanidx];
         Channel *curchanptr = c->chan;
         string namestr = c->name;
         
@@ -62,6 +68,10 @@ void ChanScreen::display(MonitorData *d){
         int ww = w-20;
         drawHorzBar(3,10,1,ww,c->l,NULL,VU,false);
         drawHorzBar(5,10,1,ww,c->r,NULL,VU,false);
+        mvprintw(4,10,"rms %6.1fdB  hold %6.1fdB  clips %u",
+                 todb(c->rmsl),todb(c->holdl),c->clipsl);
+        mvprintw(6,10,"rms %6.1fdB  hold %6.1fdB  clips %u",
+                 todb(c->rmsr),todb(c->holdr),c->clipsr);
         drawHorzBar(8,10,1,ww,c->gain,c->chan->gain,Gain,curparam==0);
         drawHorzBar(10,10,1,ww,c->pan,c->chan->pan,Pan,curparam==1);
         
@@ -70,7 +80,7 @@ void ChanScreen::display(MonitorData *d){
             int ww = w-20;
             ChainFeed& f = curchanptr->chains[i];
             attrset(COLOR_PAIR(0));
-            mvaddstr(y,0,curchanptr->chainNames[i].c_str());
+            mvaddstr(y,0,f.chain->name.c_str());
             
             mvaddstr(y,20,f.postfade?"POSTFADE":"PREFADE");
             
@@ -86,8 +96,8 @@ void ChanScreen::flow(InputManager *im){
     bool aborted;
     im->lock();
     MonitorData *d = MonitorThread::get()->getLastReceived();
-    bool validchan = (chanidx>=0 && chanidx<d->numchans);
-    ChanMonData *mon = validchan ? d->chans+chanidx : NULL;
+    bool validchan = (chanidx>=0 && chanidx<(int)d->chans.size());
+    ChanMonData *mon = validchan ? &d->chans[chanidx] : NULL;
     Channel *chan = mon ? mon->chan : NULL;
     int cursend = curparam-2;
     if(cursend>(int)chan->chains.size())cursend=-1; // flag invalid send
@@ -95,7 +105,7 @@ void ChanScreen::flow(InputManager *im){
     
     
     Value *curSelectedValue=NULL;
-    if(chanidx>=0 && chanidx<d->numchans){
+    if(validchan){
         switch(curparam){
         case 0:curSelectedValue = chan->gain;break;
         case 1:curSelectedValue = chan->pan;break;
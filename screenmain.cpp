@@ -12,6 +12,7 @@
 #include "screenchan.h"
 #include "screenctrl.h"
 #include "screenchain.h"
+#include "screenprof.h"
 
 #include <ncurses.h>
 #include <sstream>
@@ -49,7 +50,7 @@ void MainScreen::display(MonitorData *d){
     for(int i=0;i<numcols;i++){
         ChanMonData *c;
         int chanidx = i+firstcol;
-        if(chanidx>=0 && chanidx<(int)d->numchans){
+        if(chanidx>=0 && chanidx<(int)d->chans.size()){
             c=&d->chans[chanidx];
             if(chanidx==curchan)curchanptr=c->chan;
         } else
@@ -57,6 +58,42 @@ void MainScreen::display(MonitorData *d){
         if(c)
             displayChan(i+1,c,chanidx==curchan);
     }
+    // how much of the mix was skipped because there was nothing to
+    // mix
+    attrset(COLOR_PAIR(0));
+    mvprintw(1,w-RIGHTWIDTH,"skip %u/%u",d->pathsSkipped,d->paths);
+    displayLoudness(w-RIGHTWIDTH,d);
+}
+
+// a loudness reading, or dashes if there isn't one yet
+static void loudstr(char *buf,float v){
+    if(v<=LOUDNESS_NONE)
+        strcpy(buf,"  --");
+    else
+        sprintf(buf,"%5.1f",v);
+}
+
+void MainScreen::displayLoudness(int x,MonitorData *d){
+    int h = MonitorThread::get()->h;
+    attrset(COLOR_PAIR(0)|A_BOLD);
+    mvaddstr(2,x,"LOUDNESS");
+    attrset(COLOR_PAIR(0));
+    int y=3;
+    for(unsigned int i=0;i<d->loudness.size() && y+3<h;i++){
+        LoudnessReading& r = d->loudness[i].r;
+        char m[16],s[16],in[16],tp[16];
+        loudstr(m,r.momentary);
+        loudstr(s,r.shortterm);
+        loudstr(in,r.integrated);
+        loudstr(tp,r.maxtruepeak);
+        mvprintw(y++,x,"%.*s",RIGHTWIDTH-1,d->loudness[i].name.c_str());
+        mvprintw(y++,x,"M %s S %s",m,s);
+        // over 0dBTP will clip somewhere downstream
+        if(r.maxtruepeak>0)
+            attrset(COLOR_PAIR(PAIR_REDTEXT));
+        mvprintw(y++,x,"I %s TP %s",in,tp);
+        attrset(COLOR_PAIR(0));
+    }
 }
 
 void MainScreen::displayChan(int i,ChanMonData* c,bool cur){
@@ -64,6 +101,7 @@ void MainScreen::displayChan(int i,ChanMonData* c,bool cur){
     
     float l,r,gain,pan;
     const char *name;
+    bool clipped=false;
     
     int h = MonitorThread::get()->h;
     
@@ -81,7 +119,8 @@ void MainScreen::displayChan(int i,ChanMonData* c,bool cur){
         
         gain=c->gain;
         pan=c->pan;
-        name = c->name;
+        name = c->name.c_str();
+        clipped = c->clipsl || c->clipsr;
         
         if(c->chan){
             Channel *ch = c->chan;
@@ -106,10 +145,11 @@ void MainScreen::displayChan(int i,ChanMonData* c,bool cur){
         name="xxxx";
     }
     
+    // the name is red once the channel has clipped
     if(cur)
-        attrset(COLOR_PAIR(PAIR_HILIGHT)|A_BOLD);
+        attrset(COLOR_PAIR(clipped ? PAIR_REDTEXT : PAIR_HILIGHT)|A_BOLD);
     else
-        attrset(COLOR_PAIR(0));
+        attrset(clipped ? COLOR_PAIR(PAIR_REDTEXT) : COLOR_PAIR(0));
     
     mvprintw(0,x,"%s",name);
     
@@ -218,6 +258,10 @@ void MainScreen::flow(InputManager *im){
         im->push();
         im->go(&scrCtrl);
         break;
+    case 'P':
+        im->push();
+        im->go(&scrProf);
+        break;
     case 'm':case 'M':
         if(curchanptr){
             ProcessCommand cmd(ProcessCommandType::ChannelMute);
@@ -232,6 +276,14 @@ void MainScreen::flow(InputManager *im){
             Process::writeCmd(cmd);
         }
         break;
+    case 'l':
+        if(curchanptr){
+            ProcessCommand cmd(ProcessCommandType::ToggleLoudness);
+            cmd.setchan(curchanptr);
+            Process::writeCmd(cmd);
+        } else
+            im->setStatus("The master is always loudness metered",4);
+        break;
     case 10:
         if(curchan>=0){
             im->push();
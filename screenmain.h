@@ -18,6 +18,8 @@ private:
     int curchan=0;
     class Channel *curchanptr=NULL;
     void displayChan(int i,struct ChanMonData* c,bool cur); // c=NULL if invalid
+    // the loudness meters, in the space on the right
+    void displayLoudness(int x,struct MonitorData *d);
     
     void commandGainNudge(float v);
     void commandPanNudge(float v);
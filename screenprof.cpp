@@ -0,0 +1,174 @@
+/**
+ * @file screenprof.cpp
+ * @brief The DSP profile screen. The chain view lists the phases of the
+ * mix and then each chain followed by its effects; the top view lists
+ * the chains and effects sorted by cost, biggest first.
+ *
+ */
+
+#include "monitor.h"
+#include "fx.h"
+#include "profile.h"
+#include "denormals.h"
+
+#include "screenprof.h"
+
+#include <ncurses.h>
+#include <algorithm>
+
+using namespace std;
+
+ProfileScreen scrProf;
+
+// the columns, and their widths; there is a space before each
+// column but the first.
+enum ProfCol {ColName,ColRuns,ColMin,ColAvg,ColP99,ColMax,ColLoad,
+    ColSubnormals,NUMPROFCOLS};
+static const int colWidths[NUMPROFCOLS]={30,9,8,8,8,8,6,10};
+static const char *colNames[NUMPROFCOLS]={"NAME","RUNS","MIN us",
+    "AVG us","P99 us","MAX us","CPU%","SUBNORMALS"};
+
+// where a column ends on the screen
+static int colEnd(int c){
+    int x=colWidths[0];
+    for(int i=1;i<=c;i++)
+        x+=1+colWidths[i];
+    return x;
+}
+
+// what the top view is sorted by, and the columns they are in
+enum ProfSort {ByLoad,ByAvg,ByP99,ByMax,NUMPROFSORTS};
+static const ProfCol sortCols[]={ColLoad,ColAvg,ColP99,ColMax};
+static ProfSort sortBy=ByLoad;
+static bool topView=false;
+// when the counters were last reset, for the CPU share
+static Time resetTime;
+
+struct ProfRow {
+    string name;
+    ProfSummary s;
+    // indented under a chain
+    bool isEffect;
+    // an effect, so it has subnormal counts
+    bool hasDenormals;
+};
+
+static double sortKey(const ProfRow& r){
+    switch(sortBy){
+    case ByAvg:return r.s.avg;
+    case ByP99:return r.s.p99;
+    case ByMax:return r.s.max;
+    default:return r.s.total;
+    }
+}
+
+static bool compareRows(const ProfRow& a,const ProfRow& b){
+    return sortKey(a)>sortKey(b);
+}
+
+static void addRow(vector<ProfRow>& rows,const string& name,ProfStats *p,
+                   bool isEffect){
+    ProfRow r;
+    r.name = name;
+    r.isEffect = isEffect;
+    r.hasDenormals = false;
+    p->get(r.s);
+    rows.push_back(r);
+}
+
+void ProfileScreen::display(MonitorData *d){
+    title(topView ? "DSP PROFILE: TOP CONSUMERS" : "DSP PROFILE: CHAINS");
+    int h = MonitorThread::get()->h;
+
+    vector<ProfRow> rows;
+    if(!topView){
+        for(int i=0;i<NUMPROFPHASES;i++)
+            addRow(rows,Profile::phaseNames[i],Profile::phases[i],false);
+    }
+    MonitorThread::get()->lock();
+    for(unsigned int i=0;i<chainlist.size();i++){
+        ChainInterface *c = chainlist[i];
+        addRow(rows,c->suspended.load() ? c->name+" (suspended)" : c->name,
+               c->prof,false);
+        const vector<PluginInstance *>& fx = c->getEffects();
+        for(unsigned int j=0;j<fx.size();j++){
+            addRow(rows,topView ? c->name+"/"+fx[j]->name : fx[j]->name,
+                   fx[j]->prof,!topView);
+            rows.back().hasDenormals = true;
+        }
+    }
+    MonitorThread::get()->unlock();
+    if(topView)
+        stable_sort(rows.begin(),rows.end(),compareRows);
+
+    double elapsed = (Time()-resetTime)*1e6;
+
+    attrset(COLOR_PAIR(0)|A_BOLD);
+    bool denorms = Denormals::check.load();
+    int ncols = denorms ? NUMPROFCOLS : ColSubnormals;
+    mvprintw(1,0,"%-*s",colWidths[ColName],colNames[ColName]);
+    for(int i=1;i<ncols;i++)
+        printw(" %*s",colWidths[i],colNames[i]);
+    if(topView){
+        // mark the column sorted on
+        ProfCol c = sortCols[sortBy];
+        attrset(COLOR_PAIR(PAIR_HILIGHT)|A_BOLD);
+        mvaddstr(1,colEnd(c)-(int)strlen(colNames[c]),colNames[c]);
+    }
+    attrset(COLOR_PAIR(0));
+
+    int y=2;
+    for(unsigned int i=0;i<rows.size() && y<h-2;i++,y++){
+        ProfRow& r = rows[i];
+        string n = (r.isEffect ? "  " : "")+r.name;
+        if((int)n.size()>colWidths[ColName])
+            n.resize(colWidths[ColName]);
+        mvprintw(y,0,"%-*s",colWidths[ColName],n.c_str());
+        if(!r.s.count){
+            printw(" %*s",colWidths[ColRuns],"-");
+            continue;
+        }
+        printw(" %*llu",colWidths[ColRuns],(unsigned long long)r.s.count);
+        printw(" %*.1f",colWidths[ColMin],r.s.min);
+        printw(" %*.1f",colWidths[ColAvg],r.s.avg);
+        printw(" %*.1f",colWidths[ColP99],r.s.p99);
+        printw(" %*.1f",colWidths[ColMax],r.s.max);
+        printw(" %*.1f",colWidths[ColLoad],
+               elapsed>0 ? r.s.total*100.0/elapsed : 0.0);
+        if(denorms && r.hasDenormals){
+            if(r.s.denormals)
+                attrset(COLOR_PAIR(PAIR_REDTEXT)|A_BOLD);
+            printw(" %*llu",colWidths[ColSubnormals],
+                   (unsigned long long)r.s.denormals);
+            attrset(COLOR_PAIR(0));
+        }
+    }
+}
+
+void ProfileScreen::flow(InputManager *im){
+    int c = im->getKey();
+    switch(c){
+    case 'q':case 10:
+        im->pop();
+        break;
+    case 'h':
+        im->push();
+        im->go(&scrHelp);
+        break;
+    case 't':
+        topView=!topView;
+        break;
+    case 'o':
+        sortBy = (ProfSort)((sortBy+1)%NUMPROFSORTS);
+        topView=true;
+        break;
+    case 'd':
+        Denormals::check=!Denormals::check.load();
+        break;
+    case 'r':
+        Profile::reset();
+        resetTime = Time();
+        break;
+    default:break;
+    }
+}
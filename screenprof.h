@@ -0,0 +1,20 @@
+/**
+ * @file screenprof.h
+ * @brief The DSP profile screen, showing what each phase of the mix,
+ * each chain and each effect costs.
+ *
+ */
+
+#ifndef __SCREENPROF_H
+#define __SCREENPROF_H
+
+#include "screen.h"
+
+extern class ProfileScreen : public Screen {
+public:
+    virtual void display(struct MonitorData *d);
+    virtual void flow(class InputManager *im);
+} scrProf;
+
+
+#endif /* __SCREENPROF_H */
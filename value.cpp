@@ -11,17 +11,44 @@
 using namespace std;
 
 vector<Value *> Value::values;
+vector<Value *> Value::detached;
+int Value::period=1;
+int Value::rampStart=0;
+Value **Value::activeSet=NULL;
+unsigned int Value::numActive=0;
+unsigned int Value::maxActive=0;
 
 Value::~Value(){
-    values.erase(std::remove(values.begin(),values.end(),this),values.end());
+    if(linked)
+        values.erase(std::remove(values.begin(),values.end(),this),values.end());
 }
 
-void Value::updateAll(){
-    vector<Value *>::iterator it;
-    for(it=values.begin();it!=values.end();it++){
-        (*it)->update();
+void Value::link(){
+    if(linked)return;
+    values.push_back(this);
+    linked=true;
+}
+
+void Value::unlink(){
+    if(linked){
+        if(ctrl)
+            detached.push_back(this);
+        values.erase(std::remove(values.begin(),values.end(),this),values.end());
+        linked=false;
     }
-};
+}
+
+void Value::startActive(vector<Value *>& vals,Value **set,unsigned int n){
+    activeSet = set;
+    maxActive = n;
+    numActive = 0;
+    for(unsigned int i=0;i<vals.size();i++){
+        Value *v = vals[i];
+        v->active=false;
+        if(!v->settled())
+            v->activate();
+    }
+}
 
 void Value::removeCtrl(Ctrl *c){
     vector<Value *>::iterator it;
@@ -45,8 +72,8 @@ string Value::toString(){
     // options
     if(db)ss << "db ";
     
-    if(fabsf(0.5f-smooth)>0.001f)
-        ss << "smooth " << smooth << " ";
+    if(fabsf(DEFAULTSMOOTHMS-smoothms)>0.001f)
+        ss << "smoothms " << smoothms << " ";
     
     if(optsset & VALOPTS_MIN)
         ss << "min " << mn << " ";
@@ -21,44 +21,96 @@
 #define MINDB -60.0f
 #define MAXDB 6.0f
 
+// default smoothing time constant
+#define DEFAULTSMOOTHMS 10.0f
+
 // these are the values used in the mixer: pan positions, gains etc.
 // and effect parameters. They can either be constants, or have a default
 // value but be modifiable from a control channel.
 
 class Value {
     friend class Ctrl;
+    friend struct MixGraph;
     
     /// the current value, set from the LPF
     float value;
+    /// the value at the start of the current period; the mixer
+    /// ramps from this to value across the period.
+    float prev;
+    /// value and prev after any dB conversion, worked out only when
+    /// they change so that get() is cheap.
+    float conv,convprev;
     /// the post-conversion default value
     float deflt;
     /// the target value, input to the LPF
     float target;
-    /// the smoothing value for updates - the closer to 1, the more slowly
-    /// the value tracks the target. 0.5 (the default) is really quick,
-    /// 0.9 gives a nice smoothness. 0.99 is very slow, useful for crossfades.
+    /// the smoothing time constant in milliseconds: the time taken
+    /// to get about 63% of the way to the target. 0 is no smoothing,
+    /// 10 (the default) is quick, 1000 is slow, useful for crossfades.
+    float smoothms;
+    /// the per-period LPF coefficient worked out from smoothms, and
+    /// the period and sample rate it was worked out for.
     /// value(t) = value(t-1)*smooth + target*(1-smooth)
     float smooth;
+    int smoothFrames;
+    unsigned int smoothRate;
     
-    /// list of all values
+    /// list of all values, copied into each MixGraph for updating
     static std::vector<Value *> values;
+    /// true if this value is in the list
+    bool linked;
+    /// values unlinked while still attached to a controller; the next
+    /// MixGraph takes them, and the process thread detaches them.
+    static std::vector<Value *> detached;
     
     /// what external controller, if any, is controlling me. Generally
     /// used only for information (saving, monitoring).
     class Ctrl *ctrl;
     
+    /// the active set: the values which are still moving, so need
+    /// updating each ramp. It lives in the process thread's MixGraph,
+    /// and only the process thread uses it; active is true while a
+    /// value is in it.
+    bool active;
+    static Value **activeSet;
+    static unsigned int numActive,maxActive;
+    
+    /// add to the active set, unless it is full, which can happen
+    /// for values the current graph doesn't have yet. Those are
+    /// added when the next graph is picked up.
+    void activate(){
+        if(!active && numActive<maxActive){
+            active=true;
+            activeSet[numActive++]=this;
+        }
+    }
+    
+    /// true if update() would do nothing
+    bool settled(){
+        return value==target && prev==value;
+    }
+    
 public:
     Value(std::string nm){
         name = nm;
         deflt=0;
-        smooth=0.5;
+        value=prev=target=conv=convprev=0;
+        setsmoothms(DEFAULTSMOOTHMS);
         db=false;
         mn=0;mx=1;
         ctrl=NULL;
-        values.push_back(this);
+        active=false;
+        linked=false;
+        link();
         optsset=0;
     }
     
+    /// add to the list of values updated each period
+    void link();
+    /// remove from the list; any controller is detached when the
+    /// process thread picks up the next graph.
+    void unlink();
+    
     class Ctrl *getCtrl(){
         return ctrl;
     }
@@ -100,13 +152,33 @@ public:
     /// set DB (decibel conversion will be done in get()))
     Value *setdb(){
         db=true;
+        conv = convert(value);
+        convprev = convert(prev);
         return this;
     }
-    /// set smoothing factor (see notes for smooth, above)
-    Value *setsmooth(float s){
-        smooth=s;
+    /// set smoothing time in milliseconds (see notes for smoothms, above)
+    Value *setsmoothms(float ms){
+        smoothms = ms<0 ? 0 : ms;
+        smoothFrames=0; // force recalculation of the coefficient
         return this;
     }
+    /// set smoothing from an old-style per-period factor (see
+    /// smoothFactorToMs)
+    Value *setsmooth(float s){
+        return setsmoothms(smoothFactorToMs(s));
+    }
+    float getsmoothms(){
+        return smoothms;
+    }
+    
+    /// older configs gave smoothing as a factor applied once per jack
+    /// period, so how fast it was depended on the period size. Convert
+    /// one to a time constant assuming 256 frame periods at 48kHz.
+    static float smoothFactorToMs(float s){
+        if(s<=0)return 0;
+        if(s>0.9999f)s=0.9999f;
+        return -(256.0f/48.0f)/logf(s);
+    }
     /// set range
     Value *setrange(float a,float b){
         mn=a;mx=b;
@@ -132,6 +204,8 @@ public:
         if(v>mx)v=mx;
         if(v<mn)v=mn;
         target=v;
+        if(target!=value)
+            activate();
     }
     
     /// sets the target value, converting from 0-1 first.
@@ -146,13 +220,28 @@ public:
         return (target-mn)/(mx-mn);
     }
     
+    /// do dB conversion if required
+    float convert(float v){
+        return db ? powf(10.0,v*0.1f) : v;
+    }
+    
     /// get the value for actual use (i.e. do dB conversion)
     float get(){
+        return conv;
+    }
+    /// get the value at the start of the period, for ramping
+    float getStart(){
+        return convprev;
+    }
+    /// true if this is a gain at the bottom of its dB range, or zero,
+    /// for the whole of the current ramp, so that what it multiplies
+    /// can be left out
+    bool isOff(){
         if(db)
-            return powf(10.0,value*0.1f);
-        else
-            return value;
+            return value<=MINDB && prev<=MINDB;
+        return conv==0 && convprev==0;
     }
+    
     /// get the value without dB conversion
     float getNoDBConvert(){
         return value;
@@ -167,17 +256,62 @@ public:
     
     /// reset value and target to default
     Value* reset(){
-        value = target = deflt;
+        prev = value = target = deflt;
+        convprev = conv = convert(value);
         return this;
     }
     
-    /// perform periodic update
-    void update(){
-        value = value*smooth + target*(1.0f-smooth);
+    /// perform periodic update, moving the value towards the target
+    /// by an amount depending on the length of the period. Only the
+    /// values in the active set need it (see updateActive()).
+    void update(int nframes,unsigned int samprate){
+        prev = value;
+        convprev = conv;
+        if(value!=target){
+            // periods can be split at controller changes, so the
+            // length varies; only work this out when it's needed.
+            if(nframes!=smoothFrames || samprate!=smoothRate){
+                float t = smoothms*0.001f*samprate;
+                smooth = t>0 ? expf(-nframes/t) : 0;
+                smoothFrames = nframes;
+                smoothRate = samprate;
+            }
+            value = value*smooth + target*(1.0f-smooth);
+            // snap to the target when close, so we stop converting
+            if(fabsf(value-target) <= (mx-mn)*1e-6f)
+                value = target;
+            conv = convert(value);
+        }
+    }
+    
+    /// start a new active set with room for n values, and put the
+    /// values which are still moving in it. Called by the process
+    /// thread when it picks up a graph.
+    static void startActive(std::vector<Value *>& vals,Value **set,
+                            unsigned int n);
+    
+    /// update the values in the active set, and take out those which
+    /// have settled
+    static void updateActive(int nframes,unsigned int samprate){
+        Value **a = activeSet;
+        unsigned int n = numActive;
+        for(unsigned int i=0;i<n;){
+            Value *v = a[i];
+            v->update(nframes,samprate);
+            if(v->settled()){
+                v->active=false;
+                a[i]=a[--n];
+            } else
+                i++;
+        }
+        numActive=n;
     }
     
-    /// update all values
-    static void updateAll();
+    /// the length of the current ramp, across which gains
+    /// ramp from getStart() to get(), and the frame in the period
+    /// it starts at. A period is split into several ramps when
+    /// controller changes arrive partway through it.
+    static int period,rampStart;
     
     /// convert to a string for saving
     std::string toString();
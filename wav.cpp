@@ -0,0 +1,200 @@
+/**
+ * @file wav.cpp
+ * @brief Minimal WAV file reading and writing.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "exception.h"
+#include "wav.h"
+
+using namespace std;
+
+// little-endian helpers; the WAV format is always little-endian
+
+static uint32_t getu32(const unsigned char *p){
+    return p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t)p[3]<<24);
+}
+static uint16_t getu16(const unsigned char *p){
+    return p[0] | (p[1]<<8);
+}
+static void putu32(unsigned char *p,uint32_t v){
+    p[0]=v&0xff;p[1]=(v>>8)&0xff;p[2]=(v>>16)&0xff;p[3]=(v>>24)&0xff;
+}
+static void putu16(unsigned char *p,uint16_t v){
+    p[0]=v&0xff;p[1]=(v>>8)&0xff;
+}
+
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_EXTENSIBLE 0xfffe
+
+WavFile::WavFile(string fn){
+    name = fn;
+    FILE *a = fopen(fn.c_str(),"rb");
+    if(!a)
+        throw _("cannot open WAV file '%s'",fn.c_str());
+    
+    unsigned char hdr[12];
+    if(fread(hdr,1,12,a)!=12 || memcmp(hdr,"RIFF",4) || memcmp(hdr+8,"WAVE",4)){
+        fclose(a);
+        throw _("'%s' is not a WAV file",fn.c_str());
+    }
+    
+    int format=-1,bits=0;
+    uint32_t datasize=0;
+    numchans=0;
+    samprate=0;
+    numframes=0;
+    
+    // walk the chunks until we have both a format and some data
+    for(;;){
+        unsigned char ch[8];
+        if(fread(ch,1,8,a)!=8){
+            fclose(a);
+            throw _("no data chunk in '%s'",fn.c_str());
+        }
+        uint32_t size = getu32(ch+4);
+        if(!memcmp(ch,"fmt ",4)){
+            unsigned char fmt[40];
+            if(size<16 || size>sizeof(fmt) || fread(fmt,1,size,a)!=size){
+                fclose(a);
+                throw _("bad format chunk in '%s'",fn.c_str());
+            }
+            format = getu16(fmt);
+            numchans = getu16(fmt+2);
+            samprate = getu32(fmt+4);
+            bits = getu16(fmt+14);
+            // the real format is the first two bytes of the subformat GUID
+            if(format==WAVE_FORMAT_EXTENSIBLE && size>=26)
+                format = getu16(fmt+24);
+            if(size&1)fgetc(a);
+        } else if(!memcmp(ch,"data",4)){
+            if(format<0){
+                fclose(a);
+                throw _("data before format chunk in '%s'",fn.c_str());
+            }
+            datasize = size;
+            break;
+        } else {
+            // skip unknown chunks (padded to even sizes)
+            if(fseek(a,(long)size+(size&1),SEEK_CUR)){
+                fclose(a);
+                throw _("truncated WAV file '%s'",fn.c_str());
+            }
+        }
+    }
+    
+    // we're now at the start of the data chunk; allow for files whose
+    // data chunk claims more than is there.
+    long pos = ftell(a);
+    if(pos<0 || fseek(a,0,SEEK_END)){
+        fclose(a);
+        throw _("cannot seek in WAV file '%s'",fn.c_str());
+    }
+    long end = ftell(a);
+    if(end<pos || fseek(a,pos,SEEK_SET)){
+        fclose(a);
+        throw _("cannot seek in WAV file '%s'",fn.c_str());
+    }
+    if((unsigned long)(end-pos)<datasize)
+        datasize = end-pos;
+    
+    if(!numchans || !(
+        (format==WAVE_FORMAT_PCM && (bits==16 || bits==24 || bits==32)) ||
+        (format==WAVE_FORMAT_IEEE_FLOAT && bits==32))){
+        fclose(a);
+        throw _("unsupported WAV format in '%s' (format %d, %d bits)",
+                fn.c_str(),format,bits);
+    }
+    
+    unsigned int bytesPerSample = bits/8;
+    unsigned int frameSize = bytesPerSample*numchans;
+    vector<unsigned char> raw(datasize);
+    if(datasize)
+        datasize = fread(&raw[0],1,datasize,a);
+    fclose(a);
+    
+    numframes = datasize/frameSize;
+    data.resize(numchans);
+    for(unsigned int c=0;c<numchans;c++)
+        data[c].resize(numframes+1); // +1 so getChannel() works when empty
+    
+    const unsigned char *p = raw.data();
+    for(unsigned int i=0;i<numframes;i++){
+        for(unsigned int c=0;c<numchans;c++){
+            float f;
+            if(format==WAVE_FORMAT_IEEE_FLOAT){
+                uint32_t u = getu32(p);
+                memcpy(&f,&u,4);
+            } else switch(bits){
+            case 16:
+                f = (int16_t)getu16(p) * (1.0f/32768.0f);
+                break;
+            case 24:
+                f = ((int32_t)((p[0]<<8)|(p[1]<<16)|((uint32_t)p[2]<<24))>>8) *
+                      (1.0f/8388608.0f);
+                break;
+            default:
+                f = (int32_t)getu32(p) * (1.0f/2147483648.0f);
+                break;
+            }
+            data[c][i]=f;
+            p+=bytesPerSample;
+        }
+    }
+}
+
+WavWriter::WavWriter(string fn,uint32_t samprate){
+    f = fopen(fn.c_str(),"wb");
+    if(!f)
+        throw _("cannot open '%s' for writing",fn.c_str());
+    framesWritten = 0;
+    
+    // write a header with zero sizes; close() fixes them up.
+    unsigned char hdr[44];
+    memcpy(hdr,"RIFF",4);
+    putu32(hdr+4,36);
+    memcpy(hdr+8,"WAVEfmt ",8);
+    putu32(hdr+16,16);
+    putu16(hdr+20,WAVE_FORMAT_IEEE_FLOAT);
+    putu16(hdr+22,2);
+    putu32(hdr+24,samprate);
+    putu32(hdr+28,samprate*2*sizeof(float));
+    putu16(hdr+32,2*sizeof(float));
+    putu16(hdr+34,32);
+    memcpy(hdr+36,"data",4);
+    putu32(hdr+40,0);
+    fwrite(hdr,1,44,f);
+}
+
+WavWriter::~WavWriter(){
+    close();
+}
+
+void WavWriter::write(const float *left,const float *right,unsigned int n){
+    interleaved.resize(n*2);
+    for(unsigned int i=0;i<n;i++){
+        interleaved[i*2]=left[i];
+        interleaved[i*2+1]=right[i];
+    }
+    // assumes a little-endian host, as does the rest of jackmix
+    fwrite(&interleaved[0],sizeof(float),n*2,f);
+    framesWritten+=n;
+}
+
+void WavWriter::close(){
+    if(!f)return;
+    unsigned char sz[4];
+    uint32_t datasize = framesWritten*2*sizeof(float);
+    putu32(sz,36+datasize);
+    fseek(f,4,SEEK_SET);
+    fwrite(sz,1,4,f);
+    putu32(sz,datasize);
+    fseek(f,40,SEEK_SET);
+    fwrite(sz,1,4,f);
+    fclose(f);
+    f=NULL;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file wav.h
+ * @brief Minimal WAV file reading and writing, used by the offline
+ * renderer. Reads 16/24/32-bit integer and 32-bit float PCM, writes
+ * 32-bit float.
+ *
+ */
+
+#ifndef __WAV_H
+#define __WAV_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// a WAV file loaded entirely into memory, one float buffer per channel.
+
+struct WavFile {
+    std::string name;
+    uint32_t samprate;
+    unsigned int numchans;
+    unsigned int numframes;
+    // deinterleaved data, one vector per channel
+    std::vector<std::vector<float> > data;
+
+    // load a file, throwing a string on error
+    WavFile(std::string fn);
+
+    // get a channel, or NULL if there is no such channel
+    float *getChannel(unsigned int c){
+        return c<numchans ? &data[c][0] : NULL;
+    }
+};
+
+// writes a stereo 32-bit float WAV file a block at a time, fixing
+// up the header sizes on close.
+
+class WavWriter {
+    FILE *f;
+    uint32_t framesWritten;
+    std::vector<float> interleaved;
+public:
+    // open the file, throwing a string on error
+    WavWriter(std::string fn,uint32_t samprate);
+    ~WavWriter();
+
+    // write a block of stereo data
+    void write(const float *left,const float *right,unsigned int n);
+
+    // rewrite the header and close the file
+    void close();
+};
+
+
+#endif /* __WAV_H */
@@ -0,0 +1,152 @@
+/**
+ * @file workers.cpp
+ * @brief Worker thread pool for running independent jobs in parallel
+ * in the process thread.
+ *
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <jack/jack.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "workers.h"
+#include "process.h"
+#include "exception.h"
+#include "denormals.h"
+
+int Workers::numThreads=1;
+Workers::Share Workers::shares[MAXWORKERS];
+std::atomic<WorkerFunc> Workers::func(NULL);
+std::atomic<void *> Workers::context(NULL);
+std::atomic<int> Workers::remaining(0);
+std::atomic<bool> Workers::quit(false);
+
+// the worker threads (index 0 is the process thread, which has none),
+// and the semaphores they wait on between runs.
+static pthread_t threads[MAXWORKERS];
+static sem_t wake[MAXWORKERS];
+
+// how many times the process thread checks for the last jobs to
+// finish before it starts giving up the CPU between checks
+#define MAXSPINS 2000
+
+// tell the CPU we're spinning, so it doesn't starve its other
+// hyperthread or mispredict the loop exit
+static inline void relax(){
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#endif
+}
+
+void Workers::init(int n){
+    if(n<=0)
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n<1)n=1;
+    if(n>MAXWORKERS)n=MAXWORKERS;
+
+    quit.store(false);
+    for(int i=0;i<MAXWORKERS;i++)
+        shares[i].range.store(0);
+
+    int i;
+    for(i=1;i<n;i++){
+        sem_init(&wake[i],0,0);
+        int rv;
+        // workers run at the same priority as the jack process thread
+        if(Process::client)
+            rv = jack_client_create_thread(Process::client,&threads[i],
+                       jack_client_real_time_priority(Process::client),
+                       jack_is_realtime(Process::client),
+                       threadFunc,(void *)(intptr_t)i);
+        else
+            rv = pthread_create(&threads[i],NULL,threadFunc,(void *)(intptr_t)i);
+        if(rv){
+            sem_destroy(&wake[i]);
+            if(i==1)
+                throw _("cannot create worker thread");
+            break; // make do with the ones we have
+        }
+    }
+    numThreads = i;
+}
+
+void Workers::shutdown(){
+    quit.store(true);
+    for(int i=1;i<numThreads;i++)
+        sem_post(&wake[i]);
+    for(int i=1;i<numThreads;i++)
+        pthread_join(threads[i],NULL);
+    numThreads=1;
+}
+
+void *Workers::threadFunc(void *arg){
+    int self = (int)(intptr_t)arg;
+    for(;;){
+        if(sem_wait(&wake[self])<0 && errno==EINTR)
+            continue;
+        if(quit.load())
+            break;
+        Denormals::apply();
+        work(self);
+    }
+    return NULL;
+}
+
+void Workers::work(int self){
+    for(int k=0;k<numThreads;k++){
+        Share& s = shares[(self+k)%numThreads];
+        for(;;){
+            uint64_t r = s.range.fetch_add(1,std::memory_order_acq_rel);
+            uint32_t next = (uint32_t)r;
+            uint32_t end = (uint32_t)(r>>32);
+            if(next>=end)
+                break;
+            WorkerFunc f = func.load(std::memory_order_relaxed);
+            (*f)(context.load(std::memory_order_relaxed),next);
+            remaining.fetch_sub(1,std::memory_order_release);
+        }
+    }
+}
+
+void Workers::run(int njobs,WorkerFunc f,void *ctx){
+    int nt = numThreads<njobs ? numThreads : njobs;
+    if(nt<=1){
+        for(int i=0;i<njobs;i++)
+            (*f)(ctx,i);
+        return;
+    }
+
+    func.store(f,std::memory_order_relaxed);
+    context.store(ctx,std::memory_order_relaxed);
+    remaining.store(njobs,std::memory_order_relaxed);
+
+    // share the jobs out between the threads we're waking; a late
+    // thread from a previous run may find these, which is fine.
+    for(int i=0;i<numThreads;i++){
+        uint64_t start = i<nt ? (uint64_t)njobs*i/nt : 0;
+        uint64_t end = i<nt ? (uint64_t)njobs*(i+1)/nt : 0;
+        shares[i].range.store(start|(end<<32),std::memory_order_release);
+    }
+
+    for(int i=1;i<nt;i++)
+        sem_post(&wake[i]);
+    work(0);
+
+    // wait for anything still running elsewhere. work() has claimed
+    // every job nobody else had, so all we can do is wait; spin for a
+    // while, then yield in case the worker we're waiting for has been
+    // preempted on this CPU.
+    for(int spins=0;remaining.load(std::memory_order_acquire)>0;spins++){
+        if(spins<MAXSPINS)
+            relax();
+        else
+            sched_yield();
+    }
+}
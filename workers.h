@@ -0,0 +1,65 @@
+/**
+ * @file workers.h
+ * @brief A pool of worker threads which the process thread uses to
+ * run independent jobs (such as effect chains) in parallel. Each
+ * thread starts on its own share of the jobs and steals from the
+ * others when it runs out.
+ *
+ */
+
+#ifndef __WORKERS_H
+#define __WORKERS_H
+
+#include <atomic>
+#include <stdint.h>
+
+/// the most threads, including the process thread
+#define MAXWORKERS 32
+
+/// a job function, called with the context given to run() and the
+/// index of the job
+typedef void (*WorkerFunc)(void *ctx,int job);
+
+struct Workers {
+    /// start the pool with n threads in total, counting the process
+    /// thread, so 1 runs everything in the process thread. If 0, use
+    /// one per CPU. Realtime threads are made through jack if there
+    /// is a client.
+    static void init(int n);
+
+    /// stop the worker threads
+    static void shutdown();
+
+    /// the number of threads in use, including the process thread
+    static int getNumThreads(){
+        return numThreads;
+    }
+
+    /// called from the process thread: run jobs 0 to njobs-1 and
+    /// return when they have all finished. The process thread does
+    /// its share.
+    static void run(int njobs,WorkerFunc f,void *ctx);
+
+private:
+    // a thread's share of the jobs: the next job in the low 32 bits
+    // and the end in the top 32, so both are read in one operation
+    // and a job is claimed by adding one.
+    struct Share {
+        std::atomic<uint64_t> range;
+        char pad[64-sizeof(std::atomic<uint64_t>)];
+    };
+
+    static void *threadFunc(void *arg);
+    // do jobs until there are none left, starting with our own share
+    static void work(int self);
+
+    static int numThreads;
+    static Share shares[MAXWORKERS];
+    static std::atomic<WorkerFunc> func;
+    static std::atomic<void *> context;
+    // jobs not yet finished in this run
+    static std::atomic<int> remaining;
+    static std::atomic<bool> quit;
+};
+
+#endif /* __WORKERS_H */